@@ -1,6 +1,10 @@
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdckdint.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -25,6 +29,21 @@ struct process
   long waiting_time;
   long response_time;
   long run_time;
+  /* Where the process is in the median heaps, while it is queued */
+  long heap_index;
+  bool in_upper_heap;
+  /* What the scheduling policy orders the process by while it is
+     ready, and the order it became ready in, which breaks ties */
+  long key;
+  long seq;
+  /* Its links in the ready tree, and its level in the feedback queues */
+  struct process *left;
+  struct process *right;
+  bool red;
+  int level;
+  long level_used;
+  /* The record's number, which lottery tickets are indexed by */
+  long slot;
   /* End of "Additional fields here" */
 };
 
@@ -66,13 +85,6 @@ static long next_int(char const **data, char const *data_end)
   return current;
 }
 
-/* Return the first unsigned decimal integer scanned from DATA.
-   Report an error and exit if no integer is found, or if it overflows.  */
-static long next_int_from_c_str(char const *data)
-{
-  return next_int(&data, strchr(data, 0));
-}
-
 /* A vector of processes of length NPROCESSES; the vector consists of
    PROCESS[0], ..., PROCESS[NPROCESSES - 1].  */
 struct process_set
@@ -156,198 +168,1341 @@ static struct process_set init_processes(char const *filename)
   return (struct process_set){nprocesses, process};
 }
 
-//comparator function for sorting the runtime int array
-int compare_ints (const void * elem1, const void * elem2) 
+/* The run times of the queued processes, split into two heaps so the
+   median can be read in O(1) time and kept up to date in O(log n) time
+   as processes join and leave the queue.  LOWER is a max-heap of the
+   smaller half, UPPER a min-heap of the rest, and UPPER has the extra
+   process when the count is odd.  Each process records its own
+   position, so any process can be taken out, not just a top.  */
+struct median_heaps
+{
+  struct process **lower;
+  struct process **upper;
+  long nlower;
+  long nupper;
+};
+
+/* Return true if A belongs above B in the heap UPPER or LOWER.  */
+static bool heap_above(bool upper, struct process const *a,
+                       struct process const *b)
+{
+  return upper ? a->run_time < b->run_time : a->run_time > b->run_time;
+}
+
+static void heap_set(struct process **heap, long index, struct process *p)
+{
+  heap[index] = p;
+  p->heap_index = index;
+}
+
+static void sift_up(struct process **heap, bool upper, long index)
+{
+  struct process *p = heap[index];
+  while (index > 0 && heap_above(upper, p, heap[(index - 1) / 2]))
+  {
+    heap_set(heap, index, heap[(index - 1) / 2]);
+    index = (index - 1) / 2;
+  }
+  heap_set(heap, index, p);
+}
+
+static void sift_down(struct process **heap, long n, bool upper, long index)
+{
+  struct process *p = heap[index];
+  for (;;)
+  {
+    long child = 2 * index + 1;
+    if (child >= n)
+      break;
+    if (child + 1 < n && heap_above(upper, heap[child + 1], heap[child]))
+      child++;
+    if (!heap_above(upper, heap[child], p))
+      break;
+    heap_set(heap, index, heap[child]);
+    index = child;
+  }
+  heap_set(heap, index, p);
+}
+
+static void heap_push(struct median_heaps *heaps, bool upper,
+                      struct process *p)
+{
+  struct process **heap = upper ? heaps->upper : heaps->lower;
+  long n = upper ? heaps->nupper++ : heaps->nlower++;
+  p->in_upper_heap = upper;
+  heap_set(heap, n, p);
+  sift_up(heap, upper, n);
+}
+
+/* Remove P from whichever heap holds it, filling its place with that
+   heap's last process.  */
+static void heap_remove(struct median_heaps *heaps, struct process *p)
+{
+  bool upper = p->in_upper_heap;
+  struct process **heap = upper ? heaps->upper : heaps->lower;
+  long n = upper ? --heaps->nupper : --heaps->nlower;
+  long index = p->heap_index;
+  if (index == n)
+    return;
+  struct process *last = heap[n];
+  heap_set(heap, index, last);
+  sift_up(heap, upper, index);
+  sift_down(heap, n, upper, last->heap_index);
+}
+
+/* Move tops between the heaps until UPPER has as many processes as
+   LOWER, or one more.  */
+static void median_rebalance(struct median_heaps *heaps)
+{
+  while (heaps->nlower > heaps->nupper)
+  {
+    struct process *p = heaps->lower[0];
+    heap_remove(heaps, p);
+    heap_push(heaps, true, p);
+  }
+  while (heaps->nupper > heaps->nlower + 1)
+  {
+    struct process *p = heaps->upper[0];
+    heap_remove(heaps, p);
+    heap_push(heaps, false, p);
+  }
+}
+
+static void median_insert(struct median_heaps *heaps, struct process *p)
+{
+  bool lower = heaps->nupper > 0 && p->run_time < heaps->upper[0]->run_time;
+  heap_push(heaps, !lower, p);
+  median_rebalance(heaps);
+}
+
+static void median_remove(struct median_heaps *heaps, struct process *p)
+{
+  heap_remove(heaps, p);
+  median_rebalance(heaps);
+}
+
+/* Return the median run time of the queued processes, of which there
+   must be at least one.  With an even count it is the mean of the two
+   middle run times, rounded down.  */
+static long median_run_time(struct median_heaps const *heaps)
+{
+  long median = heaps->upper[0]->run_time;
+  if ((heaps->nlower + heaps->nupper) % 2 == 0)
+  {
+    /* FIRST never exceeds MEDIAN, so this cannot overflow the way
+       summing the two could.  */
+    long first = heaps->lower[0]->run_time;
+    median = first + (median - first) / 2;
+  }
+  return median;
+}
+
+/* Return A + B.  Report an error and exit if the sum overflows, as
+   quanta, switch costs and burst times are only bounded by LONG_MAX.  */
+static long checked_add(long a, long b)
+{
+  long sum;
+  if (ckd_add(&sum, a, b))
+  {
+    fprintf(stderr, "integer overflow\n");
+    exit(1);
+  }
+  return sum;
+}
+
+/* Return A * B.  Report an error and exit if the product overflows.  */
+static long checked_mul(long a, long b)
 {
-    long a = *((long*)elem1);
-    long b = *((long*)elem2);
-    if (a > b) return 1;
-    if (a < b) return -1;
+  long product;
+  if (ckd_mul(&product, a, b))
+  {
+    fprintf(stderr, "integer overflow\n");
+    exit(1);
+  }
+  return product;
+}
+
+/* With a fixed QUANTUM, the NQUEUED processes in LIST take turns running
+   a full quantum each, with a context switch costing SWITCH_COST after
+   every turn if there is more than one of them, for as long as no
+   process finishes and nothing arrives.  Every process in LIST must have
+   run already.  Apply as many whole rounds of turns at once as can pass
+   before a process would finish or the next arrival, at NEXT_ARRIVAL (or
+   never if it is negative), would join the queue, starting at time NOW.
+   Return how long the skipped rounds took.  */
+static long skip_rounds(struct process_list *list, long nqueued,
+                        long quantum, long switch_cost, long next_arrival,
+                        long now)
+{
+  long switches = nqueued > 1 ? switch_cost : 0;
+  /* Not even one round fits in the clock, so leave it to the turns
+     themselves to report the overflow.  */
+  long round;
+  if (ckd_add(&round, quantum, switches) || ckd_mul(&round, round, nqueued))
+    return 0;
+
+  /* A process arriving at NEXT_ARRIVAL joins during the first turn that
+     would end after it, and the last turn of a round ends just before
+     the round's last context switch.  */
+  long rounds = LONG_MAX;
+  if (0 <= next_arrival)
+  {
+    long span;
+    if (ckd_add(&span, next_arrival - now, switches))
+      span = LONG_MAX;
+    rounds = span < 0 ? 0 : span / round;
+  }
+  struct process *p;
+  TAILQ_FOREACH(p, list, pointers)
+  {
+    long left = (p->remaining_time - 1) / quantum;
+    if (left < rounds)
+      rounds = left;
+  }
+  if (rounds <= 0)
     return 0;
+
+  TAILQ_FOREACH(p, list, pointers)
+  {
+    p->remaining_time -= rounds * quantum;
+    p->run_time += rounds * quantum;
+  }
+  return checked_mul(rounds, round);
 }
 
-//comparator function for sorting the process list array (stable)
-int compare_arrivals (const void *elem1, const void *elem2)
+/* Return true if A comes before B in a ready heap or tree: it has the
+   smaller key, or the same key and it became ready first.  */
+static bool key_before(struct process const *a, struct process const *b)
 {
-  struct process a = *((struct process*) elem1);
-  struct process b = *((struct process*) elem2);
-  if (a.arrival_time > b.arrival_time) return 1;
-  if (a.arrival_time < b.arrival_time) return -1;
-  return 0;
+  return a->key < b->key || (a->key == b->key && a->seq < b->seq);
 }
 
-// main program
-int main(int argc, char *argv[])
+/* A binary min-heap of ready processes, ordered by key_before.  */
+struct ready_heap
+{
+  struct process **process;
+  long n;
+};
+
+static void ready_heap_push(struct ready_heap *heap, struct process *p)
 {
-  if (argc != 3)
+  long index = heap->n++;
+  while (index > 0 && key_before(p, heap->process[(index - 1) / 2]))
   {
-    fprintf(stderr, "%s: usage: %s file quantum\n", argv[0], argv[0]);
-    return 1;
+    heap->process[index] = heap->process[(index - 1) / 2];
+    index = (index - 1) / 2;
   }
+  heap->process[index] = p;
+}
 
-  struct process_set ps = init_processes(argv[1]);
-  long quantum_length = (strcmp(argv[2], "median") == 0 ? -1
-                                                        : next_int_from_c_str(argv[2]));
-  if (quantum_length == 0)
+static struct process *ready_heap_pop(struct ready_heap *heap)
+{
+  struct process *top = heap->process[0];
+  struct process *p = heap->process[--heap->n];
+  long index = 0;
+  for (;;)
   {
-    fprintf(stderr, "%s: zero quantum length\n", argv[0]);
+    long child = 2 * index + 1;
+    if (child >= heap->n)
+      break;
+    if (child + 1 < heap->n
+        && key_before(heap->process[child + 1], heap->process[child]))
+      child++;
+    if (!key_before(heap->process[child], p))
+      break;
+    heap->process[index] = heap->process[child];
+    index = child;
+  }
+  heap->process[index] = p;
+  return top;
+}
+
+/* A left-leaning red-black tree of ready processes, ordered by
+   key_before.  The processes are the nodes, so inserting and taking out
+   the first one allocate nothing.  */
+static bool tree_red(struct process const *p)
+{
+  return p && p->red;
+}
+
+static struct process *tree_rotate_left(struct process *p)
+{
+  struct process *x = p->right;
+  p->right = x->left;
+  x->left = p;
+  x->red = p->red;
+  p->red = true;
+  return x;
+}
+
+static struct process *tree_rotate_right(struct process *p)
+{
+  struct process *x = p->left;
+  p->left = x->right;
+  x->right = p;
+  x->red = p->red;
+  p->red = true;
+  return x;
+}
+
+static void tree_flip(struct process *p)
+{
+  p->red = !p->red;
+  p->left->red = !p->left->red;
+  p->right->red = !p->right->red;
+}
+
+/* Restore the tree's invariants at P on the way back up.  */
+static struct process *tree_fixup(struct process *p)
+{
+  if (tree_red(p->right) && !tree_red(p->left))
+    p = tree_rotate_left(p);
+  if (tree_red(p->left) && tree_red(p->left->left))
+    p = tree_rotate_right(p);
+  if (tree_red(p->left) && tree_red(p->right))
+    tree_flip(p);
+  return p;
+}
+
+static struct process *tree_insert(struct process *root, struct process *p)
+{
+  if (!root)
+  {
+    p->left = p->right = NULL;
+    p->red = true;
+    return p;
+  }
+  if (key_before(p, root))
+    root->left = tree_insert(root->left, p);
+  else
+    root->right = tree_insert(root->right, p);
+  return tree_fixup(root);
+}
+
+/* Return ROOT with its first process taken out.  */
+static struct process *tree_remove_first(struct process *root)
+{
+  if (!root->left)
+    return NULL;
+  if (!tree_red(root->left) && !tree_red(root->left->left))
+  {
+    tree_flip(root);
+    if (tree_red(root->right->left))
+    {
+      root->right = tree_rotate_right(root->right);
+      root = tree_rotate_left(root);
+      tree_flip(root);
+    }
+  }
+  root->left = tree_remove_first(root->left);
+  return tree_fixup(root);
+}
+
+struct scheduler;
+
+/* A scheduling policy.  The simulator hands it each process that becomes
+   ready, by arriving or by being preempted with time left, asks it which
+   ready process to run next and for how long, and tells it how long that
+   process ran and whether it finished.  The optional RESERVE makes room
+   in the policy's arrays for the scheduler's CAPACITY of processes, which
+   grows with the number that have arrived but not finished.  The
+   optional FAST_FORWARD may run the chosen process and those ready for a
+   while at once, returning how long that took.  */
+struct policy
+{
+  char const *name;
+  /* Whether the quantum may be "median"  */
+  bool median_quantum;
+  /* Whether a process arriving just as a slice ends is ready before the
+     process that ran, rather than after it  */
+  bool arrivals_first;
+  /* Whether an arrival ends the running process's slice  */
+  bool preemptive;
+  void (*init) (struct scheduler *s);
+  void (*reserve) (struct scheduler *s);
+  void (*enqueue) (struct scheduler *s, struct process *p);
+  struct process *(*pick_next) (struct scheduler *s);
+  long (*slice) (struct scheduler *s, struct process *p);
+  void (*on_tick) (struct scheduler *s, struct process *p, long ran);
+  void (*on_finish) (struct scheduler *s, struct process *p);
+  long (*fast_forward) (struct scheduler *s, struct process *p);
+};
+
+/* The levels of the multi-level feedback queue, each with twice the
+   quantum of the one above, and how many top-level quanta pass between
+   moving every process back to the top.  */
+#define MLFQ_LEVELS 3
+#define MLFQ_BOOST_QUANTA 32
+
+/* The tickets every process holds under lottery and stride scheduling,
+   and the stride of a process holding one ticket.  */
+#define TICKETS 100
+#define STRIDE1 10000
+
+/* The number of quanta in which CFS tries to run every ready process.  */
+#define CFS_LATENCY_QUANTA 8
+
+/* One simulation: where the processes come from, the clock, and the
+   ready processes in whichever structure the policy keeps them.  */
+struct scheduler
+{
+  struct policy const *policy;
+  /* The processes are either the NPROCESSES in PROCESS, sorted by
+     arrival time, or read from STREAM a line at a time into RECORDS,
+     which are put on FREE to be reused once their processes finish.
+     NEXT is the next process to arrive, or NULL if there are no more.  */
+  struct process *process;
+  long nprocesses;
+  long arrival_index;
+  FILE *stream;
+  char *line;
+  size_t line_size;
+  long nlines;
+  struct process **records;
+  long nrecords;
+  long records_size;
+  struct process_list free;
+  struct process *next;
+  /* How many processes have arrived, how many of them have not
+     finished, and how many the policy has room for  */
+  long narrived;
+  long nactive;
+  long capacity;
+  long time;
+  /* The fixed quantum, or -1 for the median quantum  */
+  long quantum;
+  long switch_cost;
+  long nready;
+  long next_seq;
+  /* rr, fcfs and mlfq: FIFO queues, one per level  */
+  struct process_list queue[MLFQ_LEVELS];
+  /* rr: the median heaps, whether a median quantum has been handed
+     out yet, and the slices run since a process joined or left  */
+  struct median_heaps heaps;
+  bool median_started;
+  long quiet_slices;
+  /* mlfq: when every process next moves back to the top level  */
+  long next_boost;
+  /* sjf, srtf and stride: a heap; cfs: a tree  */
+  struct ready_heap heap;
+  struct process *tree;
+  /* stride and cfs: the key a newly arrived process starts with  */
+  long min_key;
+  /* lottery: a Fenwick tree of the tickets of the ready processes,
+     indexed by slot, with room for a power of two of them, and the
+     random number state  */
+  long *tickets;
+  long ticket_slots;
+  long total_tickets;
+  uint64_t random;
+};
+
+/* Return the arrival time of the next process to arrive, or -1 if every
+   process has arrived.  */
+static long next_arrival(struct scheduler const *s)
+{
+  return s->next ? s->next->arrival_time : -1;
+}
+
+static void *xcalloc(long n, size_t size)
+{
+  void *p = calloc(n, size);
+  if (!p)
+  {
+    perror("calloc");
+    exit(1);
+  }
+  return p;
+}
+
+static void *xrealloc(void *p, long n, size_t size)
+{
+  p = realloc(p, n * size);
+  if (!p)
+  {
+    perror("realloc");
+    exit(1);
+  }
+  return p;
+}
+
+static void rr_reserve(struct scheduler *s)
+{
+  if (s->quantum < 0)
+  {
+    s->heaps.lower = xrealloc(s->heaps.lower, s->capacity,
+                              sizeof *s->heaps.lower);
+    s->heaps.upper = xrealloc(s->heaps.upper, s->capacity,
+                              sizeof *s->heaps.upper);
+  }
+}
+
+static void rr_enqueue(struct scheduler *s, struct process *p)
+{
+  TAILQ_INSERT_TAIL(&s->queue[0], p, pointers);
+  if (s->quantum < 0)
+    median_insert(&s->heaps, p);
+  if (!p->already_start)
+    s->quiet_slices = 0;
+}
+
+static struct process *fifo_pick_next(struct scheduler *s)
+{
+  struct process *p = TAILQ_FIRST(&s->queue[0]);
+  TAILQ_REMOVE(&s->queue[0], p, pointers);
+  return p;
+}
+
+/* The median quantum is 1 on the first dispatch, and after that the
+   median run time of the queued processes, P included, or 1 if that is
+   0.  P stays in the median heaps until it runs.  */
+static long rr_slice(struct scheduler *s, struct process *p)
+{
+  (void) p;
+  if (0 < s->quantum)
+    return s->quantum;
+  if (!s->median_started)
+  {
+    s->median_started = true;
     return 1;
   }
+  long median = median_run_time(&s->heaps);
+  return median <= 0 ? 1 : median;
+}
 
-  struct process_list list;
-  TAILQ_INIT(&list);
+static void rr_on_tick(struct scheduler *s, struct process *p, long ran)
+{
+  (void) ran;
+  s->quiet_slices++;
+  if (s->quantum < 0)
+    median_remove(&s->heaps, p);
+}
 
-  long total_wait_time = 0;
-  long total_response_time = 0;
+static void rr_on_finish(struct scheduler *s, struct process *p)
+{
+  (void) p;
+  s->quiet_slices = 0;
+}
 
-  /* Your code here */
-  int proc_count = 0; //# of processes already run
-  int proc_running = 0;
-  bool dynamic_quantum = quantum_length == -1; //returns true if quantum is determined using median
-  qsort(ps.process, ps.nprocesses, sizeof(struct process), compare_arrivals); //stable sort processes based on arrival
-  // for (int i = 0; i < ps.nprocesses; i++){
-  //   printf("%ld, ", (&ps.process[i])->pid);
-  // }
-  // printf("\n");
-
-  struct process *first_proc = &ps.process[0];
-  int time = first_proc->arrival_time;
-  int arrival_index = 1;
-  // insert first process into the queue
-  TAILQ_INSERT_TAIL(&list, &ps.process[0], pointers);
-  
-  // while queue isn't empty
-  while (!TAILQ_EMPTY(&list)){
-    struct process *curr_process = TAILQ_FIRST(&list);
-
-    // first time a process runs
-    if (!curr_process->already_start){      
-      curr_process->already_start = true;
-      proc_count++;
-      curr_process->remaining_time = curr_process->burst_time;
-      long res = time - curr_process->arrival_time;
-      curr_process->response_time = res;
-      total_response_time += res;
+/* With a fixed quantum, once every queued process has had a turn since
+   the queue last changed, the same round repeats until a process
+   finishes or another arrives, so skip straight to the last rounds
+   before that.  P is put back at the head of the queue it was taken
+   from while the rounds are counted.  */
+static long rr_fast_forward(struct scheduler *s, struct process *p)
+{
+  if (s->quantum < 0 || s->quiet_slices < s->nready + 1)
+    return 0;
+  s->quiet_slices = 0;
+  TAILQ_INSERT_HEAD(&s->queue[0], p, pointers);
+  long skipped = skip_rounds(&s->queue[0], s->nready + 1, s->quantum,
+                             s->switch_cost, next_arrival(s), s->time);
+  TAILQ_REMOVE(&s->queue[0], p, pointers);
+  return skipped;
+}
+
+static void fifo_enqueue(struct scheduler *s, struct process *p)
+{
+  TAILQ_INSERT_TAIL(&s->queue[0], p, pointers);
+}
+
+static long whole_slice(struct scheduler *s, struct process *p)
+{
+  (void) s;
+  return p->remaining_time;
+}
+
+static void heap_reserve(struct scheduler *s)
+{
+  s->heap.process = xrealloc(s->heap.process, s->capacity,
+                             sizeof *s->heap.process);
+}
+
+/* SJF and SRTF both order by time left; SJF just never preempts, so for
+   it that is the burst time.  */
+static void shortest_enqueue(struct scheduler *s, struct process *p)
+{
+  p->key = p->remaining_time;
+  ready_heap_push(&s->heap, p);
+}
+
+static struct process *heap_pick_next(struct scheduler *s)
+{
+  return ready_heap_pop(&s->heap);
+}
+
+static long mlfq_quantum(struct scheduler const *s, int level)
+{
+  return checked_mul(s->quantum, 1L << level);
+}
+
+static void mlfq_init(struct scheduler *s)
+{
+  s->next_boost = checked_mul(mlfq_quantum(s, 0), MLFQ_BOOST_QUANTA);
+}
+
+static void mlfq_enqueue(struct scheduler *s, struct process *p)
+{
+  TAILQ_INSERT_TAIL(&s->queue[p->level], p, pointers);
+}
+
+static struct process *mlfq_pick_next(struct scheduler *s)
+{
+  if (s->next_boost <= s->time)
+  {
+    for (int level = 1; level < MLFQ_LEVELS; level++)
+    {
+      struct process *p;
+      TAILQ_FOREACH(p, &s->queue[level], pointers)
+      {
+        p->level = 0;
+        p->level_used = 0;
+      }
+      TAILQ_CONCAT(&s->queue[0], &s->queue[level], pointers);
     }
+    s->next_boost = checked_add(s->time, checked_mul(mlfq_quantum(s, 0),
+                                                     MLFQ_BOOST_QUANTA));
+  }
+
+  int level = 0;
+  while (TAILQ_EMPTY(&s->queue[level]))
+    level++;
+  struct process *p = TAILQ_FIRST(&s->queue[level]);
+  TAILQ_REMOVE(&s->queue[level], p, pointers);
+  return p;
+}
+
+/* A process may use its level's quantum in several slices if arrivals
+   preempt it, and moves down a level once it has used it all.  */
+static long mlfq_slice(struct scheduler *s, struct process *p)
+{
+  return mlfq_quantum(s, p->level) - p->level_used;
+}
 
-    // printf("num running: %d\n", proc_running);
+static void mlfq_on_tick(struct scheduler *s, struct process *p, long ran)
+{
+  p->level_used += ran;
+  if (mlfq_quantum(s, p->level) <= p->level_used)
+  {
+    if (p->level + 1 < MLFQ_LEVELS)
+      p->level++;
+    p->level_used = 0;
+  }
+}
 
-    // printf("===== clock time: %ld =====\n", time);
-    // struct process *p;
-    // TAILQ_FOREACH(p, &list, pointers) {
-    //   printf("pid: %ld\n", p->pid);
-    // }
+static long fixed_slice(struct scheduler *s, struct process *p)
+{
+  (void) p;
+  return s->quantum;
+}
+
+static void lottery_init(struct scheduler *s)
+{
+  s->random = 42;
+}
 
+/* Add N tickets to those of the process in SLOT in the Fenwick tree.  */
+static void lottery_add(struct scheduler *s, long slot, long n)
+{
+  for (long i = slot + 1; i <= s->ticket_slots; i += i & -i)
+    s->tickets[i] += n;
+  s->total_tickets += n;
+}
 
-    //get the quantum median
-    if (dynamic_quantum) {
-      if (quantum_length <= 0){
-        quantum_length = 1;
+/* Double the Fenwick tree until it has room for P's slot.  With a power
+   of two of slots, each new entry covers only new slots, which hold no
+   tickets, except the last, which covers them all.  */
+static void lottery_enqueue(struct scheduler *s, struct process *p)
+{
+  if (s->ticket_slots <= p->slot)
+  {
+    long old = s->ticket_slots;
+    long slots = old ? old : 16;
+    while (slots <= p->slot)
+      slots *= 2;
+    s->tickets = xrealloc(s->tickets, slots + 1, sizeof *s->tickets);
+    memset(&s->tickets[old + 1], 0, (slots - old) * sizeof *s->tickets);
+    for (long size = 2 * old; old && size <= slots; size *= 2)
+      s->tickets[size] = s->total_tickets;
+    s->ticket_slots = slots;
+  }
+  lottery_add(s, p->slot, TICKETS);
+}
+
+/* Draw a ticket at random and find the process holding it by walking
+   down the Fenwick tree.  */
+static struct process *lottery_pick_next(struct scheduler *s)
+{
+  uint64_t x = s->random;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  s->random = x;
+  long draw = x * 0x2545F4914F6CDD1DULL % s->total_tickets;
+
+  long slot = 0;
+  for (long step = s->ticket_slots; step; step /= 2)
+    if (slot + step <= s->ticket_slots && s->tickets[slot + step] <= draw)
+    {
+      slot += step;
+      draw -= s->tickets[slot];
+    }
+  lottery_add(s, slot, -TICKETS);
+  return s->stream ? s->records[slot] : &s->process[slot];
+}
+
+/* Stride and CFS start a newly arrived process at the least key handed
+   out so far, so it neither waits for the others to catch up nor gets
+   the processor to itself.  */
+static void stride_enqueue(struct scheduler *s, struct process *p)
+{
+  if (!p->already_start)
+    p->key = s->min_key;
+  ready_heap_push(&s->heap, p);
+}
+
+static struct process *stride_pick_next(struct scheduler *s)
+{
+  struct process *p = ready_heap_pop(&s->heap);
+  s->min_key = p->key;
+  return p;
+}
+
+static void stride_on_tick(struct scheduler *s, struct process *p, long ran)
+{
+  (void) s;
+  p->key = checked_add(p->key, checked_mul(STRIDE1 / TICKETS, ran));
+}
+
+static void cfs_enqueue(struct scheduler *s, struct process *p)
+{
+  if (!p->already_start)
+    p->key = s->min_key;
+  s->tree = tree_insert(s->tree, p);
+  s->tree->red = false;
+}
+
+static struct process *cfs_pick_next(struct scheduler *s)
+{
+  struct process *p = s->tree;
+  while (p->left)
+    p = p->left;
+  if (!tree_red(s->tree->left) && !tree_red(s->tree->right))
+    s->tree->red = true;
+  s->tree = tree_remove_first(s->tree);
+  if (s->tree)
+    s->tree->red = false;
+  if (s->min_key < p->key)
+    s->min_key = p->key;
+  return p;
+}
+
+/* Split the target latency among the ready processes, but never slice
+   finer than the quantum.  */
+static long cfs_slice(struct scheduler *s, struct process *p)
+{
+  (void) p;
+  long slice = checked_mul(s->quantum, CFS_LATENCY_QUANTA) / (s->nready + 1);
+  return slice < s->quantum ? s->quantum : slice;
+}
+
+static void cfs_on_tick(struct scheduler *s, struct process *p, long ran)
+{
+  (void) s;
+  p->key += ran;
+}
+
+static struct policy const policies[] =
+{
+  {.name = "rr", .median_quantum = true, .reserve = rr_reserve,
+   .enqueue = rr_enqueue, .pick_next = fifo_pick_next, .slice = rr_slice,
+   .on_tick = rr_on_tick, .on_finish = rr_on_finish,
+   .fast_forward = rr_fast_forward},
+  {.name = "fcfs", .arrivals_first = true, .enqueue = fifo_enqueue,
+   .pick_next = fifo_pick_next, .slice = whole_slice},
+  {.name = "sjf", .arrivals_first = true, .reserve = heap_reserve,
+   .enqueue = shortest_enqueue, .pick_next = heap_pick_next,
+   .slice = whole_slice},
+  {.name = "srtf", .arrivals_first = true, .preemptive = true,
+   .reserve = heap_reserve, .enqueue = shortest_enqueue,
+   .pick_next = heap_pick_next, .slice = whole_slice},
+  {.name = "mlfq", .arrivals_first = true, .preemptive = true,
+   .init = mlfq_init, .enqueue = mlfq_enqueue, .pick_next = mlfq_pick_next,
+   .slice = mlfq_slice, .on_tick = mlfq_on_tick},
+  {.name = "lottery", .arrivals_first = true, .init = lottery_init,
+   .enqueue = lottery_enqueue, .pick_next = lottery_pick_next,
+   .slice = fixed_slice},
+  {.name = "stride", .arrivals_first = true, .reserve = heap_reserve,
+   .enqueue = stride_enqueue, .pick_next = stride_pick_next,
+   .slice = fixed_slice, .on_tick = stride_on_tick},
+  {.name = "cfs", .arrivals_first = true, .enqueue = cfs_enqueue,
+   .pick_next = cfs_pick_next, .slice = cfs_slice, .on_tick = cfs_on_tick},
+};
+
+/* Return the policy named NAME, or NULL if there is none.  */
+static struct policy const *find_policy(char const *name)
+{
+  for (size_t i = 0; i < sizeof policies / sizeof *policies; i++)
+    if (strcmp(policies[i].name, name) == 0)
+      return &policies[i];
+  return NULL;
+}
+
+/* Set up S to simulate POLICY on the NPROCESSES in PROCESS, or if
+   STREAM is not null, on the processes read from it.  */
+static void scheduler_init(struct scheduler *s, struct policy const *policy,
+                           struct process *process, long nprocesses,
+                           FILE *stream, long quantum, long switch_cost)
+{
+  *s = (struct scheduler){.policy = policy, .process = process,
+                          .nprocesses = nprocesses, .stream = stream,
+                          .quantum = quantum, .switch_cost = switch_cost};
+  TAILQ_INIT(&s->free);
+  for (int level = 0; level < MLFQ_LEVELS; level++)
+    TAILQ_INIT(&s->queue[level]);
+  if (policy->init)
+    policy->init(s);
+}
+
+static void scheduler_free(struct scheduler *s)
+{
+  for (long i = 0; i < s->nrecords; i++)
+    free(s->records[i]);
+  free(s->records);
+  free(s->line);
+  free(s->heaps.lower);
+  free(s->heaps.upper);
+  free(s->heap.process);
+  free(s->tickets);
+}
+
+/* Hand the policy P, which has just become ready.  */
+static void make_ready(struct scheduler *s, struct process *p)
+{
+  s->nready++;
+  p->seq = s->next_seq++;
+  s->policy->enqueue(s, p);
+}
+
+/* Return true if there is a digit from D up to END.  */
+static bool more_digits(char const *d, char const *end)
+{
+  for (; d < end; d++)
+    if ('0' <= *d && *d <= '9')
+      return true;
+  return false;
+}
+
+/* Read the next process from S's stream into a free record, skipping
+   blank lines and a first line holding just the process count, and
+   return it, or NULL at the end of the stream.  Report an error and
+   exit if a line does not hold a pid, an arrival time and a burst time,
+   or if processes do not come in arrival order.  */
+static struct process *read_process(struct scheduler *s)
+{
+  long value[3];
+  int n;
+  do
+  {
+    ssize_t len = getline(&s->line, &s->line_size, s->stream);
+    if (len < 0)
+    {
+      if (ferror(s->stream))
+      {
+        perror("read");
+        exit(1);
       }
-      else{
-        struct process *proc_i;
-        //calculate current # of processes running
-        proc_running = 0;
-        TAILQ_FOREACH(proc_i, &list, pointers) {
-          proc_running++;
-        }
-        long temp_list[proc_running];
-        int index = 0;
-        TAILQ_FOREACH(proc_i, &list, pointers) {
-          // printf("pid %ld has runtime %ld \n", proc_i->pid, proc_i->run_time);
-          temp_list[index] = proc_i->run_time;
-          index++;
-        }
+      return NULL;
+    }
+    s->nlines++;
 
-        qsort(temp_list, proc_running, sizeof(long), compare_ints);
-        int median = temp_list[proc_running / 2];
-        if (proc_running != 0 && proc_running % 2 == 0){
-          int first = temp_list[proc_running / 2 - 1];
-          int middle = (first + median) / 2;
-          //round to the nearest integer, breaking ties by rounding to even
-          median = (int) middle / 1;
-          if (middle - median > 0.5 || (middle - median == 0.5 && median % 2 == 1)){
-            median++;
-          }
-        }
+    char const *d = s->line;
+    char const *end = s->line + len;
+    for (n = 0; more_digits(d, end); n++)
+    {
+      if (n == 3)
+        break;
+      value[n] = next_int(&d, end);
+    }
+    if (n != 0 && n != 3 && !(n == 1 && s->narrived == 0 && !s->next))
+    {
+      fprintf(stderr, "line %ld: expected pid, arrival time and burst time\n",
+              s->nlines);
+      exit(1);
+    }
+  }
+  while (n != 3);
+
+  if (value[2] == 0)
+  {
+    fprintf(stderr, "process %ld has zero burst time\n", value[0]);
+    exit(1);
+  }
+  if (s->next && value[1] < s->next->arrival_time)
+  {
+    fprintf(stderr, "process %ld arrives out of order\n", value[0]);
+    exit(1);
+  }
+
+  struct process *p = TAILQ_FIRST(&s->free);
+  long slot;
+  if (p)
+  {
+    TAILQ_REMOVE(&s->free, p, pointers);
+    slot = p->slot;
+  }
+  else
+  {
+    if (s->nrecords == s->records_size)
+    {
+      s->records_size = s->records_size ? 2 * s->records_size : 16;
+      s->records = xrealloc(s->records, s->records_size, sizeof *s->records);
+    }
+    p = malloc(sizeof *p);
+    if (!p)
+    {
+      perror("malloc");
+      exit(1);
+    }
+    slot = s->nrecords;
+    s->records[s->nrecords++] = p;
+  }
+  *p = (struct process){.pid = value[0], .arrival_time = value[1],
+                        .burst_time = value[2], .slot = slot};
+  return p;
+}
+
+/* Move S->next on to the process that arrives after it.  */
+static void read_next(struct scheduler *s)
+{
+  if (s->stream)
+    s->next = read_process(s);
+  else if (s->arrival_index < s->nprocesses)
+  {
+    s->next = &s->process[s->arrival_index];
+    s->next->slot = s->arrival_index++;
+  }
+  else
+    s->next = NULL;
+}
+
+/* Hand the policy the next process to arrive, first making room for it
+   in the policy's arrays if need be.  */
+static void admit(struct scheduler *s)
+{
+  struct process *p = s->next;
+  read_next(s);
+  p->remaining_time = p->burst_time;
+  s->narrived++;
+  if (s->capacity < ++s->nactive)
+  {
+    s->capacity = s->capacity ? 2 * s->capacity : 16;
+    if (s->policy->reserve)
+      s->policy->reserve(s);
+  }
+  make_ready(s, p);
+}
+
+/* Hand the policy every process that arrives before END, or by END if
+   the policy takes arrivals first.  */
+static void admit_arrivals(struct scheduler *s, long end)
+{
+  while (s->next
+         && (s->next->arrival_time < end
+             || (s->next->arrival_time == end && s->policy->arrivals_first)))
+    admit(s);
+}
+
+/* Jump the clock to the next arrival and admit it, with any others
+   arriving then that the policy takes at once.  */
+static void admit_next_arrival(struct scheduler *s)
+{
+  s->time = s->next->arrival_time;
+  admit(s);
+  admit_arrivals(s, s->time);
+}
+
+/* Run every process in S to completion under S's policy, charging a
+   context switch whenever a different process runs next, and add
+   their total wait and response times to *TOTAL_WAIT_TIME and
+   *TOTAL_RESPONSE_TIME.  Report an error and exit if there are no
+   processes.  */
+static void simulate(struct scheduler *s, long *total_wait_time,
+                     long *total_response_time)
+{
+  struct policy const *policy = s->policy;
+  /* The process that ran last, or NULL if it finished, as its record
+     may have been reused since  */
+  struct process *last = NULL;
+  bool switching = false;
+
+  read_next(s);
+  if (!s->next)
+  {
+    fprintf(stderr, "no processes\n");
+    exit(1);
+  }
+  admit_next_arrival(s);
+  while (0 < s->nready)
+  {
+    struct process *p = policy->pick_next(s);
+    s->nready--;
+    if (switching && p != last)
+      s->time = checked_add(s->time, s->switch_cost);
+    switching = true;
+    if (policy->fast_forward)
+      s->time = checked_add(s->time, policy->fast_forward(s, p));
 
-        //if resulting median is 0, set to 1
-        if (median <= 0){
-          quantum_length = 1;
-        } else {
-          quantum_length = median;
+    if (!p->already_start)
+    {
+      p->already_start = true;
+      p->response_time = s->time - p->arrival_time;
+      *total_response_time = checked_add(*total_response_time,
+                                         p->response_time);
+    }
+
+    long runtime = policy->slice(s, p);
+    if (p->remaining_time < runtime)
+      runtime = p->remaining_time;
+    long arrival = next_arrival(s);
+    if (policy->preemptive && s->time < arrival
+        && arrival - s->time < runtime)
+      runtime = arrival - s->time;
+    long next_time = checked_add(s->time, runtime);
+
+    p->remaining_time -= runtime;
+    p->run_time += runtime;
+    if (policy->on_tick)
+      policy->on_tick(s, p, runtime);
+    admit_arrivals(s, next_time);
+    s->time = next_time;
+
+    last = 0 < p->remaining_time ? p : NULL;
+    if (last)
+      make_ready(s, p);
+    else
+    {
+      p->waiting_time = s->time - p->arrival_time - p->burst_time;
+      *total_wait_time = checked_add(*total_wait_time, p->waiting_time);
+      if (policy->on_finish)
+        policy->on_finish(s, p);
+      s->nactive--;
+      if (s->stream)
+        TAILQ_INSERT_HEAD(&s->free, p, pointers);
+    }
+
+    if (s->nready == 0 && s->next)
+      admit_next_arrival(s);
+  }
+}
+
+/* A list of values scanned from a command-line argument.  */
+struct value_list
+{
+  long n;
+  long *value;
+};
+
+/* Scan an unsigned decimal integer at *ARG, advancing *ARG past it.
+   Report an error and exit if there is none, or if it overflows.  */
+static long scan_int(char const **arg)
+{
+  char const *a = *arg;
+  long value = 0;
+  if (*a < '0' || '9' < *a)
+  {
+    fprintf(stderr, "missing integer\n");
+    exit(1);
+  }
+  for (; '0' <= *a && *a <= '9'; a++)
+    if (ckd_mul(&value, value, 10) || ckd_add(&value, value, *a - '0'))
+    {
+      fprintf(stderr, "integer overflow\n");
+      exit(1);
+    }
+  *arg = a;
+  return value;
+}
+
+/* Return the values in ARG, a comma-separated list of integers N, ranges
+   MIN-MAX and ranges with a step MIN-MAX/STEP, and, if MEDIAN_OK, the
+   string "median", which stands for -1.  Report an error that names the
+   list WHAT and exit if ARG is malformed.  */
+static struct value_list parse_values(char const *arg, bool median_ok,
+                                      char const *what)
+{
+  struct value_list list = {0, NULL};
+  long capacity = 0;
+  char const *a = arg;
+  for (;;)
+  {
+    long first, last, step = 1;
+    if (median_ok && strncmp(a, "median", 6) == 0)
+    {
+      first = last = -1;
+      a += 6;
+    }
+    else
+    {
+      first = last = scan_int(&a);
+      if (*a == '-')
+      {
+        a++;
+        last = scan_int(&a);
+        if (*a == '/')
+        {
+          a++;
+          step = scan_int(&a);
         }
+      }
+    }
+    if ((*a && *a != ',') || last < first || step == 0)
+    {
+      fprintf(stderr, "%s: bad %s list\n", arg, what);
+      exit(1);
+    }
 
-        // for (int i = 0; i < proc_running; i++){
-        //   printf("%ld, ", temp_list[i]);
-        // }
-        // printf("\nmedian is: %ld\n", quantum_length);
+    for (long v = first;; v += step)
+    {
+      if (list.n == capacity)
+      {
+        capacity = capacity ? 2 * capacity : 8;
+        list.value = realloc(list.value, capacity * sizeof *list.value);
+        if (!list.value)
+        {
+          perror("realloc");
+          exit(1);
+        }
       }
+      list.value[list.n++] = v;
+      if (last - v < step)
+        break;
     }
-  
-  // printf("process %ld executes at time %d\n", curr_process->pid, time);        
-  // printf("\n");
-
-    // runtime of current process = min(remaining time, quantum length)
-    int runtime = curr_process->remaining_time > quantum_length ? quantum_length : curr_process->remaining_time;
-    int next_time = time + runtime;
-
-    // append newly arrived processes to queue
-    while (arrival_index < ps.nprocesses && ps.process[arrival_index].arrival_time < next_time){
-      TAILQ_INSERT_TAIL(&list, &ps.process[arrival_index], pointers);
-      // printf("process %ld arrives at time %d\n", (&ps.process[arrival_index])->pid, time);
-      arrival_index++;
+
+    if (!*a)
+      return list;
+    a++;
+  }
+}
+
+/* One configuration of a sweep, and its results.  */
+struct sweep_run
+{
+  long quantum;
+  long switch_cost;
+  long total_wait_time;
+  long total_response_time;
+};
+
+/* A sweep: every run simulates the same processes, sorted by arrival
+   time, which the workers copy and never write.  Workers take the next
+   run from NEXT_RUN until none are left.  */
+struct sweep
+{
+  struct policy const *policy;
+  struct process_set ps;
+  struct sweep_run *run;
+  long nruns;
+  atomic_long next_run;
+};
+
+static void *sweep_worker(void *arg)
+{
+  struct sweep *sweep = arg;
+  long nprocesses = sweep->ps.nprocesses;
+  struct process *process = xcalloc(nprocesses, sizeof *process);
+
+  for (;;)
+  {
+    long i = atomic_fetch_add(&sweep->next_run, 1);
+    if (sweep->nruns <= i)
+      break;
+    struct sweep_run *run = &sweep->run[i];
+    memcpy(process, sweep->ps.process, nprocesses * sizeof *process);
+    struct scheduler s;
+    scheduler_init(&s, sweep->policy, process, nprocesses, NULL,
+                   run->quantum, run->switch_cost);
+    simulate(&s, &run->total_wait_time, &run->total_response_time);
+    scheduler_free(&s);
+  }
+
+  free(process);
+  return NULL;
+}
+
+/* Simulate every run in SWEEP on a pool of threads, one per processor
+   but no more than there are runs.  */
+static void run_sweep(struct sweep *sweep)
+{
+  long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads < 1)
+    nthreads = 1;
+  if (sweep->nruns < nthreads)
+    nthreads = sweep->nruns;
+
+  pthread_t *threads = xcalloc(nthreads, sizeof *threads);
+  for (long i = 0; i < nthreads; i++)
+  {
+    int err = pthread_create(&threads[i], NULL, sweep_worker, sweep);
+    if (err)
+    {
+      fprintf(stderr, "pthread_create: %s\n", strerror(err));
+      exit(1);
     }
+  }
+  for (long i = 0; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+}
 
-    // run the current process
-    // printf("remaining: %ld\n", curr_process->remaining_time);
-    curr_process->remaining_time -= runtime;
-    curr_process->run_time += runtime;
-    // printf("runtime: %d\n", runtime);
-    // printf("remaining: %ld\n", curr_process->remaining_time);
-    time = next_time; // set time = before next context switch
+//comparator function for sorting the process list array (stable)
+int compare_arrivals (const void *elem1, const void *elem2)
+{
+  struct process a = *((struct process*) elem1);
+  struct process b = *((struct process*) elem2);
+  if (a.arrival_time > b.arrival_time) return 1;
+  if (a.arrival_time < b.arrival_time) return -1;
+  return 0;
+}
 
-    // remove process from queue
-    TAILQ_REMOVE(&list, curr_process, pointers);
+// main program
+int main(int argc, char *argv[])
+{
+  // with --stream, or a file of "-" for standard input, processes are read
+  // as they arrive instead of all at once, and shift the other arguments
+  bool streaming = argc > 1 && strcmp(argv[1], "--stream") == 0;
+  char **args = argv + streaming;
+  int nargs = argc - streaming;
+  if (nargs < 3 || 5 < nargs)
+  {
+    fprintf(stderr, "%s: usage: %s [--stream] file quantum [policy [switch_cost]]\n",
+            argv[0], argv[0]);
+    return 1;
+  }
+  if (strcmp(args[1], "-") == 0)
+    streaming = true;
 
-    // add current process to queue if it still has burst time left
-    if (curr_process->remaining_time > 0){
-      TAILQ_INSERT_TAIL(&list, curr_process, pointers);
+  struct process_set ps = {0, NULL};
+  FILE *stream = NULL;
+  if (!streaming)
+    ps = init_processes(args[1]);
+  else
+  {
+    stream = strcmp(args[1], "-") == 0 ? stdin : fopen(args[1], "r");
+    if (!stream)
+    {
+      perror("open");
+      exit(1);
     }
-    // otherwise, the process is done running and we get its total wait time (minus next context switch). remove from runtime list.
-    else{
-      curr_process->remaining_time = 0;
-      // printf("# running: %d ", proc_running);
-      total_wait_time += time - curr_process->arrival_time - curr_process->burst_time;
+  }
+  struct value_list quanta = parse_values(args[2], true, "quantum");
+  for (long i = 0; i < quanta.n; i++)
+    if (quanta.value[i] == 0)
+    {
+      fprintf(stderr, "%s: zero quantum length\n", argv[0]);
+      return 1;
     }
 
-    // for processes that arrive late.
-    if (TAILQ_EMPTY(&list) && proc_count < ps.nprocesses){
-      struct process *next_proc = &ps.process[arrival_index];
-      TAILQ_INSERT_TAIL(&list, next_proc, pointers);
-      arrival_index++;
-      time = next_proc->arrival_time;
+  char const *policy_name = nargs >= 4 ? args[3] : "rr";
+  struct policy const *policy = find_policy(policy_name);
+  if (!policy)
+  {
+    fprintf(stderr, "%s: unknown policy %s (choose from", argv[0], policy_name);
+    for (size_t i = 0; i < sizeof policies / sizeof *policies; i++)
+      fprintf(stderr, " %s", policies[i].name);
+    fprintf(stderr, ")\n");
+    return 1;
+  }
+  for (long i = 0; i < quanta.n; i++)
+    if (quanta.value[i] == -1 && !policy->median_quantum)
+    {
+      fprintf(stderr, "%s: %s needs a fixed quantum length\n", argv[0],
+              policy_name);
+      return 1;
+    }
+
+  struct value_list switch_costs = parse_values(nargs == 5 ? args[4] : "1",
+                                                false, "switch cost");
+
+  bool sweeping = quanta.n > 1 || switch_costs.n > 1;
+  if (sweeping && streaming)
+  {
+    fprintf(stderr, "%s: a sweep needs the whole workload, so it cannot stream\n",
+            argv[0]);
+    return 1;
+  }
+  long total_wait_time = 0;
+  long total_response_time = 0;
+
+  /* Your code here */
+  if (!streaming){
+    qsort(ps.process, ps.nprocesses, sizeof(struct process), compare_arrivals); //stable sort processes based on arrival
+  }
+
+  // a single configuration runs on the input as is; a sweep runs every
+  // combination of quantum and switch cost on its own copy of it
+  if (!sweeping){
+    // the policy keeps the ready processes however it likes; the simulator
+    // runs whichever it picks and keeps the clock and the totals
+    struct scheduler sched;
+    scheduler_init(&sched, policy, ps.process, ps.nprocesses, stream,
+                   quanta.value[0], switch_costs.value[0]);
+    simulate(&sched, &total_wait_time, &total_response_time);
+    // a stream's processes are only counted as they arrive
+    ps.nprocesses = sched.narrived;
+    scheduler_free(&sched);
+  }
+  else{
+    struct sweep sweep = {.policy = policy, .ps = ps,
+                          .nruns = quanta.n * switch_costs.n};
+    sweep.run = xcalloc(sweep.nruns, sizeof *sweep.run);
+    for (long i = 0; i < quanta.n; i++){
+      for (long j = 0; j < switch_costs.n; j++){
+        struct sweep_run *run = &sweep.run[i * switch_costs.n + j];
+        run->quantum = quanta.value[i];
+        run->switch_cost = switch_costs.value[j];
+      }
     }
+    run_sweep(&sweep);
 
-    //add context switch if we run a diff process next
-    if (TAILQ_FIRST(&list) != curr_process){
-      time += 1;
-      // printf("CONTEXT SWITCH %d\n", time);
+    printf("%8s %8s %14s %18s\n", "Quantum", "Switch", "Average wait",
+           "Average response");
+    for (long i = 0; i < sweep.nruns; i++){
+      struct sweep_run *run = &sweep.run[i];
+      char quantum[24];
+      if (run->quantum < 0)
+        strcpy(quantum, "median");
+      else
+        sprintf(quantum, "%ld", run->quantum);
+      printf("%8s %8ld %14.2f %18.2f\n", quantum, run->switch_cost,
+             run->total_wait_time / (double)ps.nprocesses,
+             run->total_response_time / (double)ps.nprocesses);
     }
+    free(sweep.run);
   }
   /* End of "Your code here" */
 
-  printf("Average wait time: %.2f\n",
-         total_wait_time / (double)ps.nprocesses);
-  printf("Average response time: %.2f\n",
-         total_response_time / (double)ps.nprocesses);
+  if (!sweeping)
+  {
+    printf("Average wait time: %.2f\n",
+           total_wait_time / (double)ps.nprocesses);
+    printf("Average response time: %.2f\n",
+           total_response_time / (double)ps.nprocesses);
+  }
 
   if (fflush(stdout) < 0 || ferror(stdout))
   {
     perror("stdout");
     return 1;
   }
+  if (stream && stream != stdin && fclose(stream) != 0)
+  {
+    perror("close");
+    return 1;
+  }
 
+  free(quanta.value);
+  free(switch_costs.value);
   free(ps.process);
   return 0;
 }
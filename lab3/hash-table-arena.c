@@ -0,0 +1,166 @@
+#include "hash-table-arena.h"
+
+#include <assert.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+/* Number of arenas each thread remembers its own part of */
+#define ARENA_THREAD_CACHE 8
+
+/* Freed objects are kept on one list per multiple of max_align_t up to
+   this many; anything larger just waits for arena_destroy */
+#define ARENA_FREE_LISTS 16
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	alignas(max_align_t) char data[];
+};
+
+/* The part of an arena owned by one thread */
+struct thread_arena {
+	struct thread_arena *next;
+	uint64_t thread_id;
+	struct arena_chunk *chunks;
+	char *cursor;
+	char *end;
+	/* Freed objects, linked through their first bytes */
+	void *free_lists[ARENA_FREE_LISTS];
+};
+
+struct arena {
+	/* Never reused, unlike the arena's address */
+	uint64_t id;
+	/* Protects the list of thread arenas */
+	pthread_mutex_t lock;
+	struct thread_arena *thread_arenas;
+};
+
+static _Atomic uint64_t next_arena_id = 1;
+static _Atomic uint64_t next_thread_id = 1;
+
+static _Thread_local uint64_t thread_id;
+static _Thread_local struct {
+	uint64_t arena_id;
+	struct thread_arena *thread_arena;
+} thread_cache[ARENA_THREAD_CACHE];
+
+struct arena *arena_create()
+{
+	struct arena *arena = calloc(1, sizeof(struct arena));
+	assert(arena != NULL);
+	arena->id = atomic_fetch_add(&next_arena_id, 1);
+	int err = pthread_mutex_init(&arena->lock, NULL);
+	if (err != 0) {
+		exit(err);
+	}
+	return arena;
+}
+
+/* Find (or make) the calling thread's part of ARENA.  Only the first
+   allocation by a thread, or one after the cache slot got reused by
+   another arena, has to take the lock. */
+static struct thread_arena *get_thread_arena(struct arena *arena)
+{
+	size_t slot = arena->id % ARENA_THREAD_CACHE;
+	if (thread_cache[slot].arena_id == arena->id) {
+		return thread_cache[slot].thread_arena;
+	}
+	if (thread_id == 0) {
+		thread_id = atomic_fetch_add(&next_thread_id, 1);
+	}
+
+	int err = pthread_mutex_lock(&arena->lock);
+	if (err != 0) {
+		exit(err);
+	}
+	struct thread_arena *thread_arena = arena->thread_arenas;
+	while (thread_arena != NULL && thread_arena->thread_id != thread_id) {
+		thread_arena = thread_arena->next;
+	}
+	if (thread_arena == NULL) {
+		thread_arena = calloc(1, sizeof(struct thread_arena));
+		assert(thread_arena != NULL);
+		thread_arena->thread_id = thread_id;
+		thread_arena->next = arena->thread_arenas;
+		arena->thread_arenas = thread_arena;
+	}
+	err = pthread_mutex_unlock(&arena->lock);
+	if (err != 0) {
+		exit(err);
+	}
+
+	thread_cache[slot].arena_id = arena->id;
+	thread_cache[slot].thread_arena = thread_arena;
+	return thread_arena;
+}
+
+static size_t align_size(size_t size)
+{
+	return (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	struct thread_arena *thread_arena = get_thread_arena(arena);
+	size = align_size(size);
+
+	size_t free_list = size / alignof(max_align_t) - 1;
+	if (free_list < ARENA_FREE_LISTS && thread_arena->free_lists[free_list] != NULL) {
+		void *object = thread_arena->free_lists[free_list];
+		thread_arena->free_lists[free_list] = *(void **) object;
+		memset(object, 0, size);
+		return object;
+	}
+
+	if ((size_t) (thread_arena->end - thread_arena->cursor) < size) {
+		size_t data_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+		struct arena_chunk *chunk = calloc(1, sizeof(struct arena_chunk) + data_size);
+		assert(chunk != NULL);
+		chunk->next = thread_arena->chunks;
+		thread_arena->chunks = chunk;
+		thread_arena->cursor = chunk->data;
+		thread_arena->end = chunk->data + data_size;
+	}
+
+	void *object = thread_arena->cursor;
+	thread_arena->cursor += size;
+	return object;
+}
+
+void arena_free(struct arena *arena, void *object, size_t size)
+{
+	struct thread_arena *thread_arena = get_thread_arena(arena);
+	size_t free_list = align_size(size) / alignof(max_align_t) - 1;
+	if (free_list < ARENA_FREE_LISTS) {
+		*(void **) object = thread_arena->free_lists[free_list];
+		thread_arena->free_lists[free_list] = object;
+	}
+}
+
+void arena_destroy(struct arena *arena)
+{
+	struct thread_arena *thread_arena = arena->thread_arenas;
+	while (thread_arena != NULL) {
+		struct arena_chunk *chunk = thread_arena->chunks;
+		while (chunk != NULL) {
+			struct arena_chunk *next = chunk->next;
+			free(chunk);
+			chunk = next;
+		}
+		struct thread_arena *next = thread_arena->next;
+		free(thread_arena);
+		thread_arena = next;
+	}
+	int err = pthread_mutex_destroy(&arena->lock);
+	if (err != 0) {
+		exit(err);
+	}
+	free(arena);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stddef.h>
+
+/* An arena hands out memory from large chunks and frees all of it at once
+   when destroyed.  Each thread gets its own set of chunks, so allocating
+   never takes a lock once a thread has made its first allocation. */
+struct arena;
+struct arena *arena_create();
+/* Returns SIZE bytes of zeroed memory, aligned for any object */
+void *arena_alloc(struct arena *arena, size_t size);
+/* Give back OBJECT, allocated with the same SIZE, for the calling thread's
+   next arena_alloc of that size to reuse */
+void arena_free(struct arena *arena, void *object, size_t size);
+void arena_destroy(struct arena *arena);
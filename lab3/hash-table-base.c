@@ -1,5 +1,7 @@
 #include "hash-table-base.h"
 
+#include "hash-table-arena.h"
+
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,8 +9,12 @@
 
 struct list_entry {
 	const char *key;
+	uint32_t hash;
+	uint32_t length;
 	uint32_t value;
 	SLIST_ENTRY(list_entry) pointers;
+	/* The key itself, when the table owns it and it is short */
+	char inline_key[];
 };
 
 SLIST_HEAD(list_head, list_entry);
@@ -18,61 +24,169 @@ struct hash_table_entry {
 };
 
 struct hash_table_base {
-	struct hash_table_entry entries[HASH_TABLE_CAPACITY];
+	hash_function_t hash;
+	/* Where list entries come from, or NULL to use calloc */
+	struct arena *arena;
+	/* Copy keys into the table instead of pointing at the caller's */
+	bool own_keys;
+	struct hash_table_entry *entries;
+	/* Always a power of two */
+	size_t capacity;
+	size_t size;
 };
 
+static struct hash_table_entry *allocate_entries(size_t capacity)
+{
+	struct hash_table_entry *entries = calloc(capacity, sizeof(struct hash_table_entry));
+	assert(entries != NULL);
+	for (size_t i = 0; i < capacity; ++i) {
+		struct hash_table_entry *entry = &entries[i];
+		SLIST_INIT(&entry->list_head);
+	}
+	return entries;
+}
+
 struct hash_table_base *hash_table_base_create()
 {
 	struct hash_table_base *hash_table = calloc(1, sizeof(struct hash_table_base));
 	assert(hash_table != NULL);
-	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
-		struct hash_table_entry *entry = &hash_table->entries[i];
-		SLIST_INIT(&entry->list_head);
-	}
+	hash_table->hash = hash_table_options.hash;
+	hash_table->arena = hash_table_options.arena ? arena_create() : NULL;
+	hash_table->own_keys = hash_table_options.own_keys;
+	hash_table->capacity = HASH_TABLE_CAPACITY;
+	hash_table->entries = allocate_entries(hash_table->capacity);
 	return hash_table;
 }
 
 static struct hash_table_entry *get_hash_table_entry(struct hash_table_base *hash_table,
-                                                     const char *key)
+                                                     uint32_t hash)
 {
-	assert(key != NULL);
-	uint32_t index = bernstein_hash(key) % HASH_TABLE_CAPACITY;
+	uint32_t index = hash & (hash_table->capacity - 1);
 	struct hash_table_entry *entry = &hash_table->entries[index];
 	return entry;
 }
 
+/* Size of an entry holding a key of LENGTH bytes.  Short keys the table
+   owns are stored right after the entry, so comparing them reads the
+   entry's own cache line. */
+static size_t list_entry_size(struct hash_table_base *hash_table, uint32_t length)
+{
+	bool inline_key = hash_table->own_keys && length < HASH_TABLE_INLINE_KEY;
+	return sizeof(struct list_entry) + (inline_key ? length + 1 : 0);
+}
+
+/* Tables that own their keys copy them, inline or into the arena */
+static const char *copy_key(struct hash_table_base *hash_table,
+                            struct list_entry *list_entry,
+                            const struct hashed_key *key)
+{
+	if (!hash_table->own_keys) {
+		return key->key;
+	}
+	char *copy = key->length < HASH_TABLE_INLINE_KEY ? list_entry->inline_key
+	           : hash_table->arena != NULL ? arena_alloc(hash_table->arena, key->length + 1)
+	           : malloc(key->length + 1);
+	assert(copy != NULL);
+	memcpy(copy, key->key, key->length + 1);
+	return copy;
+}
+
+static struct list_entry *allocate_list_entry(struct hash_table_base *hash_table,
+                                              const struct hashed_key *key)
+{
+	size_t size = list_entry_size(hash_table, key->length);
+	struct list_entry *list_entry = hash_table->arena != NULL
+		? arena_alloc(hash_table->arena, size)
+		: calloc(1, size);
+	assert(list_entry != NULL);
+	list_entry->key = copy_key(hash_table, list_entry, key);
+	list_entry->hash = key->hash;
+	list_entry->length = key->length;
+	return list_entry;
+}
+
+static void free_list_entry(struct hash_table_base *hash_table,
+                            struct list_entry *list_entry)
+{
+	size_t size = list_entry_size(hash_table, list_entry->length);
+	bool long_key = hash_table->own_keys && list_entry->length >= HASH_TABLE_INLINE_KEY;
+	if (hash_table->arena != NULL) {
+		if (long_key) {
+			arena_free(hash_table->arena, (char *) list_entry->key, list_entry->length + 1);
+		}
+		arena_free(hash_table->arena, list_entry, size);
+	}
+	else {
+		if (long_key) {
+			free((char *) list_entry->key);
+		}
+		free(list_entry);
+	}
+}
+
+/* Double the number of buckets and move every node over to its new bucket */
+static void grow(struct hash_table_base *hash_table)
+{
+	struct hash_table_entry *old_entries = hash_table->entries;
+	size_t old_capacity = hash_table->capacity;
+
+	hash_table->capacity = old_capacity * 2;
+	hash_table->entries = allocate_entries(hash_table->capacity);
+
+	for (size_t i = 0; i < old_capacity; ++i) {
+		struct list_head *old_head = &old_entries[i].list_head;
+		while (!SLIST_EMPTY(old_head)) {
+			struct list_entry *list_entry = SLIST_FIRST(old_head);
+			SLIST_REMOVE_HEAD(old_head, pointers);
+			struct hash_table_entry *entry = get_hash_table_entry(hash_table, list_entry->hash);
+			SLIST_INSERT_HEAD(&entry->list_head, list_entry, pointers);
+		}
+	}
+	free(old_entries);
+}
+
 static struct list_entry *get_list_entry(struct hash_table_base *hash_table,
-                                         const char *key,
+                                         const struct hashed_key *key,
                                          struct list_head *list_head)
 {
-	assert(key != NULL);
-
 	struct list_entry *entry = NULL;
-	
+	uint64_t nodes = 0;
+	uint64_t key_compares = 0;
+
 	SLIST_FOREACH(entry, list_head, pointers) {
-	  if (strcmp(entry->key, key) == 0) {
-	    return entry;
-	  }
+		++nodes;
+		/* Almost every other key is ruled out by hash and length alone */
+		if (entry->hash != key->hash || entry->length != key->length) {
+			continue;
+		}
+		++key_compares;
+		if (memcmp(entry->key, key->key, key->length) == 0) {
+			break;
+		}
 	}
-	return NULL;
+	count_lookup(nodes, key_compares);
+	return entry;
 }
 
 bool hash_table_base_contains(struct hash_table_base *hash_table,
                               const char *key)
 {
-	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, key);
+	assert(key != NULL);
+	struct hashed_key hashed_key = get_hashed_key(hash_table->hash, key);
+	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, hashed_key.hash);
 	struct list_head *list_head = &hash_table_entry->list_head;
-	struct list_entry *list_entry = get_list_entry(hash_table, key, list_head);
+	struct list_entry *list_entry = get_list_entry(hash_table, &hashed_key, list_head);
 	return list_entry != NULL;
 }
 
-void hash_table_base_add_entry(struct hash_table_base *hash_table,
-                               const char *key,
-                               uint32_t value)
+static void add_hashed_entry(struct hash_table_base *hash_table,
+                             const struct hashed_key *key,
+                             uint32_t value)
 {
-	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, key);
+	struct hashed_key hashed_key = *key;
+	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, hashed_key.hash);
 	struct list_head *list_head = &hash_table_entry->list_head;
-	struct list_entry *list_entry = get_list_entry(hash_table, key, list_head);
+	struct list_entry *list_entry = get_list_entry(hash_table, &hashed_key, list_head);
 
 	/* Update the value if it already exists */
 	if (list_entry != NULL) {
@@ -80,33 +194,121 @@ void hash_table_base_add_entry(struct hash_table_base *hash_table,
 		return;
 	}
 
-	list_entry = calloc(1, sizeof(struct list_entry));
-	list_entry->key = key;
+	list_entry = allocate_list_entry(hash_table, &hashed_key);
 	list_entry->value = value;
 	SLIST_INSERT_HEAD(list_head, list_entry, pointers);
+
+	++hash_table->size;
+	if (hash_table->size > hash_table->capacity * HASH_TABLE_MAX_LOAD) {
+		grow(hash_table);
+	}
+}
+
+void hash_table_base_add_entry(struct hash_table_base *hash_table,
+                               const char *key,
+                               uint32_t value)
+{
+	assert(key != NULL);
+	struct hashed_key hashed_key = get_hashed_key(hash_table->hash, key);
+	add_hashed_entry(hash_table, &hashed_key, value);
+}
+
+/* Hashing every key first lets the bucket misses of the whole batch
+   overlap, rather than each add stalling on its own */
+void hash_table_base_add_batch(struct hash_table_base *hash_table,
+                               const char **keys,
+                               const uint32_t *values,
+                               size_t n)
+{
+	struct hashed_key hashed_keys[HASH_TABLE_BATCH];
+	for (size_t start = 0; start < n; start += HASH_TABLE_BATCH) {
+		size_t count = n - start < HASH_TABLE_BATCH ? n - start : HASH_TABLE_BATCH;
+		for (size_t i = 0; i < count; ++i) {
+			assert(keys[start + i] != NULL);
+			hashed_keys[i] = get_hashed_key(hash_table->hash, keys[start + i]);
+			__builtin_prefetch(get_hash_table_entry(hash_table, hashed_keys[i].hash));
+		}
+		for (size_t i = 0; i < count; ++i) {
+			add_hashed_entry(hash_table, &hashed_keys[i], values[start + i]);
+		}
+	}
 }
 
 uint32_t hash_table_base_get_value(struct hash_table_base *hash_table,
                                    const char *key)
 {
-	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, key);
+	assert(key != NULL);
+	struct hashed_key hashed_key = get_hashed_key(hash_table->hash, key);
+	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, hashed_key.hash);
 	struct list_head *list_head = &hash_table_entry->list_head;
-	struct list_entry *list_entry = get_list_entry(hash_table, key, list_head);
+	struct list_entry *list_entry = get_list_entry(hash_table, &hashed_key, list_head);
 	assert(list_entry != NULL);
 	return list_entry->value;
 }
 
-void hash_table_base_destroy(struct hash_table_base *hash_table)
+bool hash_table_base_remove(struct hash_table_base *hash_table,
+                            const char *key)
+{
+	assert(key != NULL);
+	struct hashed_key hashed_key = get_hashed_key(hash_table->hash, key);
+	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, hashed_key.hash);
+	struct list_head *list_head = &hash_table_entry->list_head;
+	struct list_entry *list_entry = get_list_entry(hash_table, &hashed_key, list_head);
+	if (list_entry == NULL) {
+		return false;
+	}
+
+	SLIST_REMOVE(list_head, list_entry, list_entry, pointers);
+	free_list_entry(hash_table, list_entry);
+	--hash_table->size;
+	return true;
+}
+
+size_t hash_table_base_buckets(struct hash_table_base *hash_table)
 {
-	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
-		struct hash_table_entry *entry = &hash_table->entries[i];
-		struct list_head *list_head = &entry->list_head;
+	return hash_table->capacity;
+}
+
+bool hash_table_base_next(struct hash_table_base *hash_table,
+                          struct hash_table_cursor *cursor,
+                          const char **key,
+                          uint32_t *value)
+{
+	if (hash_table_cursor_pop(cursor, key, value)) {
+		return true;
+	}
+	/* Copy the next non-empty bucket out in one go, instead of walking the
+	   chain again up to where the last call stopped */
+	while (cursor->copied_count == 0 && cursor->bucket < cursor->end
+	       && cursor->bucket < hash_table->capacity) {
+		struct list_head *list_head = &hash_table->entries[cursor->bucket].list_head;
 		struct list_entry *list_entry = NULL;
-		while (!SLIST_EMPTY(list_head)) {
-			list_entry = SLIST_FIRST(list_head);
-			SLIST_REMOVE_HEAD(list_head, pointers);
-			free(list_entry);
+		SLIST_FOREACH(list_entry, list_head, pointers) {
+			hash_table_cursor_copy(cursor, list_entry->key, list_entry->length, list_entry->value);
+		}
+		++cursor->bucket;
+	}
+	return hash_table_cursor_pop(cursor, key, value);
+}
+
+void hash_table_base_destroy(struct hash_table_base *hash_table)
+{
+	/* Arena entries are all freed along with the arena */
+	if (hash_table->arena != NULL) {
+		arena_destroy(hash_table->arena);
+	}
+	else {
+		for (size_t i = 0; i < hash_table->capacity; ++i) {
+			struct hash_table_entry *entry = &hash_table->entries[i];
+			struct list_head *list_head = &entry->list_head;
+			struct list_entry *list_entry = NULL;
+			while (!SLIST_EMPTY(list_head)) {
+				list_entry = SLIST_FIRST(list_head);
+				SLIST_REMOVE_HEAD(list_head, pointers);
+				free_list_entry(hash_table, list_entry);
+			}
 		}
 	}
+	free(hash_table->entries);
 	free(hash_table);
 }
@@ -9,8 +9,24 @@ struct hash_table_base *hash_table_base_create();
 void hash_table_base_add_entry(struct hash_table_base *hash_table,
                                const char *key,
                                uint32_t value);
+/* Same as calling add_entry for each of the N keys in turn */
+void hash_table_base_add_batch(struct hash_table_base *hash_table,
+                               const char **keys,
+                               const uint32_t *values,
+                               size_t n);
 bool hash_table_base_contains(struct hash_table_base *hash_table,
                               const char *key);
 uint32_t hash_table_base_get_value(struct hash_table_base *hash_table,
                                    const char* key);
+bool hash_table_base_remove(struct hash_table_base *hash_table,
+                            const char *key);
 void hash_table_base_destroy(struct hash_table_base *hash_table);
+/* Number of buckets, for iterating with struct hash_table_cursor */
+size_t hash_table_base_buckets(struct hash_table_base *hash_table);
+/* Return the next entry of CURSOR's buckets in KEY and VALUE, or false once
+   there are none left.  Entries added or removed during the iteration may
+   or may not be returned. */
+bool hash_table_base_next(struct hash_table_base *hash_table,
+                          struct hash_table_cursor *cursor,
+                          const char **key,
+                          uint32_t *value);
@@ -1,19 +1,154 @@
 #include "hash-table-common.h"
 
+#include <assert.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 
-uint32_t bernstein_hash(const char *string)
+struct cursor_entry {
+	/* Of the key, from the start of the cursor's keys */
+	size_t key;
+	uint32_t value;
+};
+
+uint32_t bernstein_hash(const char *key, size_t length)
 {
 	uint32_t hash = 0;
-	size_t i = 0;
-	while (true) {
-		char c = string[i];
-		if (c == 0) {
-			break;
-		}
-		hash = (33 * hash) + c;
-		++i;
+	for (size_t i = 0; i < length; ++i) {
+		hash = (33 * hash) + key[i];
 	}
 	return hash;
 }
+
+/* A hash in the style of wyhash.  It consumes the key 8 or 16 bytes at a
+   time, and each step is a single 64x64->128 bit multiply whose halves are
+   folded together, so there is no long serial chain per byte and every
+   input bit affects the low bits used to pick a bucket. */
+
+#define WY_SECRET_0 0xa0761d6478bd642full
+#define WY_SECRET_1 0xe7037ed1a0b428dbull
+#define WY_SECRET_2 0x8ebc6af09c88c6e3ull
+
+static inline uint64_t wy_mix(uint64_t a, uint64_t b)
+{
+	__uint128_t product = (__uint128_t) a * b;
+	return (uint64_t) product ^ (uint64_t) (product >> 64);
+}
+
+static inline uint64_t read_64(const char *p)
+{
+	uint64_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint64_t read_32(const char *p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+/* Read 1 to 3 bytes, touching each at most once */
+static inline uint64_t read_small(const char *p, size_t length)
+{
+	return ((uint64_t) (uint8_t) p[0] << 16)
+	       | ((uint64_t) (uint8_t) p[length >> 1] << 8)
+	       | (uint8_t) p[length - 1];
+}
+
+uint32_t wy_hash(const char *key, size_t length)
+{
+	uint64_t seed = WY_SECRET_0;
+	uint64_t a = 0;
+	uint64_t b = 0;
+	size_t remaining = length;
+
+	while (remaining > 16) {
+		seed = wy_mix(read_64(key) ^ WY_SECRET_1, read_64(key + 8) ^ seed);
+		key += 16;
+		remaining -= 16;
+	}
+	/* The last 4 to 16 bytes are read as two possibly overlapping words */
+	if (remaining > 8) {
+		a = read_64(key);
+		b = read_64(key + remaining - 8);
+	}
+	else if (remaining >= 4) {
+		a = read_32(key);
+		b = read_32(key + remaining - 4);
+	}
+	else if (remaining > 0) {
+		a = read_small(key, remaining);
+	}
+	return (uint32_t) wy_mix(WY_SECRET_1 ^ length,
+	                         wy_mix(a ^ WY_SECRET_1, b ^ seed ^ WY_SECRET_2));
+}
+
+const struct hash_function hash_functions[] = {
+	{ "wy", wy_hash },
+	{ "bernstein", bernstein_hash },
+	{ NULL, NULL },
+};
+
+_Thread_local struct hash_table_lookup_stats hash_table_lookup_stats
+	__attribute__((tls_model("initial-exec")));
+
+bool hash_table_lookup_stats_enabled;
+
+struct hash_table_options hash_table_options = {
+	.hash = wy_hash,
+	.arena = true,
+	.lock = HASH_TABLE_LOCK_MUTEX,
+};
+
+void hash_table_cursor_copy(struct hash_table_cursor *cursor,
+                            const char *key,
+                            uint32_t length,
+                            uint32_t value)
+{
+	if (cursor->copied_count == cursor->copied_capacity) {
+		cursor->copied_capacity = cursor->copied_capacity == 0 ? 16 : cursor->copied_capacity * 2;
+		cursor->copied = realloc(cursor->copied,
+		                         cursor->copied_capacity * sizeof(struct cursor_entry));
+		assert(cursor->copied != NULL);
+	}
+	while (cursor->keys_capacity - cursor->keys_size < (size_t) length + 1) {
+		cursor->keys_capacity = cursor->keys_capacity == 0 ? 256 : cursor->keys_capacity * 2;
+		cursor->keys = realloc(cursor->keys, cursor->keys_capacity);
+		assert(cursor->keys != NULL);
+	}
+	memcpy(&cursor->keys[cursor->keys_size], key, length + 1);
+	cursor->copied[cursor->copied_count++] = (struct cursor_entry) {
+		.key = cursor->keys_size,
+		.value = value,
+	};
+	cursor->keys_size += length + 1;
+}
+
+bool hash_table_cursor_pop(struct hash_table_cursor *cursor,
+                           const char **key,
+                           uint32_t *value)
+{
+	if (cursor->position < cursor->copied_count) {
+		struct cursor_entry *entry = &cursor->copied[cursor->position++];
+		*key = &cursor->keys[entry->key];
+		*value = entry->value;
+		return true;
+	}
+	cursor->position = 0;
+	cursor->copied_count = 0;
+	cursor->keys_size = 0;
+	return false;
+}
+
+void hash_table_cursor_release(struct hash_table_cursor *cursor)
+{
+	free(cursor->copied);
+	free(cursor->keys);
+	cursor->copied = NULL;
+	cursor->keys = NULL;
+	cursor->copied_capacity = 0;
+	cursor->keys_capacity = 0;
+}
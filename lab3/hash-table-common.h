@@ -1,7 +1,150 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
+/* Number of buckets a table starts out with */
 #define HASH_TABLE_CAPACITY 4096
 
-uint32_t bernstein_hash(const char *string);
+/* Chained tables double their bucket count once the average chain is
+   longer than this */
+#define HASH_TABLE_MAX_LOAD 2
+
+/* Used to pad per-bucket data so neighbouring buckets never share a line */
+#define CACHE_LINE_SIZE 64
+
+/* add_batch hashes and prefetches this many keys at a time before adding
+   any of them, enough to have a good number of bucket misses in flight */
+#define HASH_TABLE_BATCH 32
+
+/* Tables that own their keys store keys shorter than this (not counting
+   the terminator) in the list entry itself, and copy longer ones */
+#define HASH_TABLE_INLINE_KEY 24
+
+/* Hashes the LENGTH bytes starting at KEY */
+typedef uint32_t (*hash_function_t)(const char *key, size_t length);
+
+uint32_t bernstein_hash(const char *key, size_t length);
+uint32_t wy_hash(const char *key, size_t length);
+
+struct hash_function {
+	const char *name;
+	hash_function_t hash;
+};
+
+/* Every available hash function, terminated by an entry with a NULL name */
+extern const struct hash_function hash_functions[];
+
+/* Kinds of lock in hash-table-lock.h */
+enum hash_table_lock_kind {
+	HASH_TABLE_LOCK_MUTEX,
+	HASH_TABLE_LOCK_ADAPTIVE,
+	HASH_TABLE_LOCK_ELIDED,
+};
+
+/* Settings a table takes on when it is created.  Changing them afterwards
+   does not affect tables that already exist. */
+struct hash_table_options {
+	hash_function_t hash;
+	/* Allocate list entries from per-thread arenas instead of calloc */
+	bool arena;
+	/* Copy keys into the table, so callers may reuse their strings */
+	bool own_keys;
+	/* What the v2 bucket locks are */
+	enum hash_table_lock_kind lock;
+	/* Sub-tables of the sharded table, 0 for one per CPU */
+	uint32_t shards;
+};
+
+extern struct hash_table_options hash_table_options;
+
+static inline uint32_t hash_key(hash_function_t hash, const char *key)
+{
+	return hash(key, strlen(key));
+}
+
+/* A key with its length and hash, worked out once per operation */
+struct hashed_key {
+	const char *key;
+	uint32_t length;
+	uint32_t hash;
+};
+
+static inline struct hashed_key get_hashed_key(hash_function_t hash, const char *key)
+{
+	size_t length = strlen(key);
+	return (struct hashed_key) { key, length, hash(key, length) };
+}
+
+/* Where an iteration over a table has got to.  Start one at bucket FIRST
+   with (struct hash_table_cursor) { .bucket = first, .end = end }, pass it
+   to the table's _next function until that returns false, then free it
+   with hash_table_cursor_release.  Buckets are numbered 0 up to what the
+   table's _buckets function returns, so disjoint bucket ranges can be
+   iterated by different threads.
+
+   The chained tables copy a whole bucket into the cursor in one pass,
+   with it locked (or inside their epoch), and then hand the copies out
+   one at a time.  So each chain is walked once, and a key that _next
+   returns stays valid until the next call even if another thread removes
+   it in the meantime. */
+struct hash_table_cursor {
+	size_t bucket;
+	size_t end;
+	/* Entries of the current bucket already returned */
+	size_t position;
+	/* The entries copied out of the last bucket, with their keys stored
+	   one after the other in KEYS */
+	struct cursor_entry *copied;
+	size_t copied_count;
+	size_t copied_capacity;
+	char *keys;
+	size_t keys_size;
+	size_t keys_capacity;
+};
+
+/* Copy an entry into CURSOR, for hash_table_cursor_pop to return later */
+void hash_table_cursor_copy(struct hash_table_cursor *cursor,
+                            const char *key,
+                            uint32_t length,
+                            uint32_t value);
+
+/* Return the next entry copied into CURSOR.  Once there are none left,
+   returns false and empties the cursor for the next bucket. */
+bool hash_table_cursor_pop(struct hash_table_cursor *cursor,
+                           const char **key,
+                           uint32_t *value);
+
+void hash_table_cursor_release(struct hash_table_cursor *cursor);
+
+/* Called once for every entry a scan comes across */
+typedef void (*hash_table_visit_t)(void *context, const char *key, uint32_t value);
+
+/* Work done by the calling thread's lookups.  Chained tables keep each
+   node's hash and key length, so they only compare keys when both match;
+   nodes counts how many key comparisons there would have been otherwise. */
+struct hash_table_lookup_stats {
+	uint64_t lookups;
+	uint64_t nodes;
+	uint64_t key_compares;
+};
+
+extern _Thread_local struct hash_table_lookup_stats hash_table_lookup_stats
+	__attribute__((tls_model("initial-exec")));
+
+/* Off unless someone asked for the numbers.  Lookups count into locals
+   either way, and only this read-only flag decides whether they are
+   published, so lookups do not write the thread-local line for nothing. */
+extern bool hash_table_lookup_stats_enabled;
+
+static inline void count_lookup(uint64_t nodes, uint64_t key_compares)
+{
+	if (__builtin_expect(!hash_table_lookup_stats_enabled, 1)) {
+		return;
+	}
+	hash_table_lookup_stats.lookups += 1;
+	hash_table_lookup_stats.nodes += nodes;
+	hash_table_lookup_stats.key_compares += key_compares;
+}
@@ -0,0 +1,40 @@
+/* For the CPU affinity calls */
+#define _GNU_SOURCE
+
+#include "hash-table-cpu.h"
+
+#include <unistd.h>
+
+#include <pthread.h>
+#include <sched.h>
+
+uint32_t count_cpus(void)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return cpus < 1 ? 1 : cpus;
+}
+
+void pin_to_cpu(pthread_attr_t *attr, uint32_t index)
+{
+#ifdef __linux__
+	cpu_set_t allowed;
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0) {
+		return;
+	}
+	int target = index % CPU_COUNT(&allowed);
+	for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+		if (!CPU_ISSET(cpu, &allowed) || target-- != 0) {
+			continue;
+		}
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		pthread_attr_setaffinity_np(attr, sizeof(cpus), &cpus);
+		return;
+	}
+#else
+	/* Nothing portable to pin with, so threads land wherever they land */
+	(void) attr;
+	(void) index;
+#endif
+}
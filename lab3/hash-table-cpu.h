@@ -0,0 +1,11 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+
+/* Number of CPUs online, at least 1 */
+uint32_t count_cpus(void);
+/* Have threads created with ATTR run only on the INDEXth of the CPUs this
+   process may use, wrapping around if there are fewer.  Does nothing where
+   threads cannot be pinned. */
+void pin_to_cpu(pthread_attr_t *attr, uint32_t index);
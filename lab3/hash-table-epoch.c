@@ -0,0 +1,236 @@
+#include "hash-table-epoch.h"
+
+#include "hash-table-common.h"
+
+#include <assert.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <pthread.h>
+
+/* Number of epochs each thread remembers its own record for */
+#define EPOCH_THREAD_CACHE 8
+
+/* Retires by one thread between attempts to move the global epoch on */
+#define EPOCH_ADVANCE_INTERVAL 64
+
+/* What a thread has retired during one epoch */
+struct limbo {
+	uint64_t epoch;
+	void **objects;
+	size_t count;
+	size_t capacity;
+};
+
+/* Objects retired in epoch e may still be seen by threads that entered in
+   e or e - 1, so they can go once the global epoch reaches e + 2.  Three
+   lists are therefore enough: by the time one comes around again its
+   objects are all safe to reclaim. */
+#define EPOCH_LIMBOS 3
+
+/* The state of one thread.  Padded so that entering and leaving an epoch
+   only ever writes to the thread's own cache line. */
+struct thread_epoch {
+	/* The global epoch when the thread entered, or 0 outside an epoch */
+	_Atomic uint64_t epoch;
+	struct thread_epoch *next;
+	uint64_t thread_id;
+	uint32_t depth;
+	uint32_t retired;
+	struct limbo limbo[EPOCH_LIMBOS];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct epoch {
+	/* Starts at 1, since 0 means a thread is outside an epoch */
+	_Atomic uint64_t global;
+	/* Never reused, unlike the epoch's address */
+	uint64_t id;
+	epoch_reclaim_t reclaim;
+	void *context;
+	/* Protects adding to the list of threads, which is never shrunk until
+	   destroy, so it can be walked without the lock */
+	pthread_mutex_t lock;
+	_Atomic(struct thread_epoch *) threads;
+};
+
+static _Atomic uint64_t next_epoch_id = 1;
+static _Atomic uint64_t next_thread_id = 1;
+
+static _Thread_local uint64_t thread_id;
+static _Thread_local struct {
+	uint64_t epoch_id;
+	struct thread_epoch *thread_epoch;
+} thread_cache[EPOCH_THREAD_CACHE];
+
+struct epoch *epoch_create(epoch_reclaim_t reclaim, void *context)
+{
+	struct epoch *epoch = calloc(1, sizeof(struct epoch));
+	assert(epoch != NULL);
+	atomic_init(&epoch->global, 1);
+	epoch->id = atomic_fetch_add(&next_epoch_id, 1);
+	epoch->reclaim = reclaim;
+	epoch->context = context;
+	atomic_init(&epoch->threads, NULL);
+	int err = pthread_mutex_init(&epoch->lock, NULL);
+	if (err != 0) {
+		exit(err);
+	}
+	return epoch;
+}
+
+/* Find (or add) the calling thread's record, the same way the arena finds
+   a thread's chunks */
+static struct thread_epoch *get_thread_epoch(struct epoch *epoch)
+{
+	size_t slot = epoch->id % EPOCH_THREAD_CACHE;
+	if (thread_cache[slot].epoch_id == epoch->id) {
+		return thread_cache[slot].thread_epoch;
+	}
+	if (thread_id == 0) {
+		thread_id = atomic_fetch_add(&next_thread_id, 1);
+	}
+
+	int err = pthread_mutex_lock(&epoch->lock);
+	if (err != 0) {
+		exit(err);
+	}
+	struct thread_epoch *thread_epoch = atomic_load_explicit(&epoch->threads,
+	                                                         memory_order_relaxed);
+	while (thread_epoch != NULL && thread_epoch->thread_id != thread_id) {
+		thread_epoch = thread_epoch->next;
+	}
+	if (thread_epoch == NULL) {
+		thread_epoch = aligned_alloc(CACHE_LINE_SIZE, sizeof(struct thread_epoch));
+		assert(thread_epoch != NULL);
+		*thread_epoch = (struct thread_epoch) { .thread_id = thread_id };
+		thread_epoch->next = atomic_load_explicit(&epoch->threads, memory_order_relaxed);
+		atomic_store_explicit(&epoch->threads, thread_epoch, memory_order_release);
+	}
+	err = pthread_mutex_unlock(&epoch->lock);
+	if (err != 0) {
+		exit(err);
+	}
+
+	thread_cache[slot].epoch_id = epoch->id;
+	thread_cache[slot].thread_epoch = thread_epoch;
+	return thread_epoch;
+}
+
+void epoch_enter(struct epoch *epoch)
+{
+	struct thread_epoch *thread_epoch = get_thread_epoch(epoch);
+	if (thread_epoch->depth++ != 0) {
+		return;
+	}
+	uint64_t global = atomic_load_explicit(&epoch->global, memory_order_relaxed);
+	atomic_store_explicit(&thread_epoch->epoch, global, memory_order_relaxed);
+	/* Nothing may be read from the table before the store is visible to
+	   a thread trying to advance the epoch */
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+void epoch_exit(struct epoch *epoch)
+{
+	struct thread_epoch *thread_epoch = get_thread_epoch(epoch);
+	assert(thread_epoch->depth > 0);
+	if (--thread_epoch->depth != 0) {
+		return;
+	}
+	atomic_store_explicit(&thread_epoch->epoch, 0, memory_order_release);
+}
+
+static void reclaim_limbo(struct epoch *epoch, struct limbo *limbo)
+{
+	for (size_t i = 0; i < limbo->count; ++i) {
+		epoch->reclaim(epoch->context, limbo->objects[i]);
+	}
+	limbo->count = 0;
+}
+
+/* Move the global epoch on if every thread inside an epoch has seen the
+   current one, and return the global epoch */
+static uint64_t try_advance(struct epoch *epoch)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+	uint64_t global = atomic_load_explicit(&epoch->global, memory_order_relaxed);
+	for (struct thread_epoch *thread_epoch = atomic_load_explicit(&epoch->threads,
+	                                                              memory_order_acquire);
+	     thread_epoch != NULL;
+	     thread_epoch = thread_epoch->next) {
+		/* Acquire pairs with epoch_exit, so the thread's reads happen
+		   before anything reclaimed once the epoch has moved on */
+		uint64_t entered = atomic_load_explicit(&thread_epoch->epoch, memory_order_acquire);
+		if (entered != 0 && entered != global) {
+			return global;
+		}
+	}
+	if (atomic_compare_exchange_strong(&epoch->global, &global, global + 1)) {
+		return global + 1;
+	}
+	return global;
+}
+
+void epoch_retire(struct epoch *epoch, void *object)
+{
+	struct thread_epoch *thread_epoch = get_thread_epoch(epoch);
+	uint64_t global = atomic_load_explicit(&epoch->global, memory_order_acquire);
+
+	/* Whatever is still in this epoch's list is from three or more epochs
+	   ago */
+	struct limbo *limbo = &thread_epoch->limbo[global % EPOCH_LIMBOS];
+	if (limbo->epoch != global) {
+		reclaim_limbo(epoch, limbo);
+		limbo->epoch = global;
+	}
+	if (limbo->count == limbo->capacity) {
+		limbo->capacity = limbo->capacity == 0 ? EPOCH_ADVANCE_INTERVAL : limbo->capacity * 2;
+		limbo->objects = realloc(limbo->objects, limbo->capacity * sizeof(void *));
+		assert(limbo->objects != NULL);
+	}
+	limbo->objects[limbo->count++] = object;
+
+	if (++thread_epoch->retired < EPOCH_ADVANCE_INTERVAL) {
+		return;
+	}
+	thread_epoch->retired = 0;
+	global = try_advance(epoch);
+	for (size_t i = 0; i < EPOCH_LIMBOS; ++i) {
+		limbo = &thread_epoch->limbo[i];
+		if (limbo->count != 0 && limbo->epoch + 2 <= global) {
+			reclaim_limbo(epoch, limbo);
+		}
+	}
+}
+
+void epoch_synchronize(struct epoch *epoch)
+{
+	assert(get_thread_epoch(epoch)->depth == 0);
+	/* Once the epoch has moved on twice, no thread can still be inside
+	   the epoch that was current when we were called */
+	uint64_t target = atomic_load_explicit(&epoch->global, memory_order_acquire) + 2;
+	while (try_advance(epoch) < target) {
+		sched_yield();
+	}
+}
+
+void epoch_destroy(struct epoch *epoch)
+{
+	struct thread_epoch *thread_epoch = atomic_load(&epoch->threads);
+	while (thread_epoch != NULL) {
+		assert(thread_epoch->depth == 0);
+		for (size_t i = 0; i < EPOCH_LIMBOS; ++i) {
+			reclaim_limbo(epoch, &thread_epoch->limbo[i]);
+			free(thread_epoch->limbo[i].objects);
+		}
+		struct thread_epoch *next = thread_epoch->next;
+		free(thread_epoch);
+		thread_epoch = next;
+	}
+	int err = pthread_mutex_destroy(&epoch->lock);
+	if (err != 0) {
+		exit(err);
+	}
+	free(epoch);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+/* Epoch based reclamation, for nodes that other threads may be reading
+   without a lock.  Such reads happen between epoch_enter and epoch_exit.
+   A node unlinked from a table is passed to epoch_retire instead of being
+   freed, and is only reclaimed once every thread that was inside an epoch
+   when it was retired has left it, so no reader can still reach it.  There
+   is no stop-the-world: each thread reclaims what it retired itself, a
+   couple of epochs later. */
+struct epoch;
+typedef void (*epoch_reclaim_t)(void *context, void *object);
+struct epoch *epoch_create(epoch_reclaim_t reclaim, void *context);
+/* Calls may nest, only the outermost pair counts */
+void epoch_enter(struct epoch *epoch);
+void epoch_exit(struct epoch *epoch);
+/* OBJECT must already be unreachable for anyone entering an epoch from now */
+void epoch_retire(struct epoch *epoch, void *object);
+/* Wait until every thread that was inside an epoch when this was called
+   has left it, so anything unreachable by then can be freed at once.  For
+   objects too big to leave waiting for the retire lists to come around.
+   The caller may not be inside an epoch. */
+void epoch_synchronize(struct epoch *epoch);
+/* Reclaims every retired object.  No thread may be inside an epoch. */
+void epoch_destroy(struct epoch *epoch);
@@ -0,0 +1,408 @@
+#include "hash-table-image.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define IMAGE_MAGIC "HTIMAGE"
+#define IMAGE_VERSION 1
+
+/* An image is laid out like a compressed sparse row matrix: the header,
+   then BUCKETS + 1 offsets into the entry array (bucket i's entries are
+   first[i] up to first[i + 1], stored next to each other), then the
+   entries, then every key with its terminator.  Each part starts on an 8
+   byte boundary.  Numbers are stored in the host's byte order. */
+struct image_header {
+	char magic[8];
+	uint32_t version;
+	/* Index of the hash function in hash_functions */
+	uint32_t hash;
+	/* A power of two */
+	uint64_t buckets;
+	uint64_t entries;
+	uint64_t key_bytes;
+};
+
+struct image_entry {
+	uint32_t hash;
+	uint32_t length;
+	/* Of the key, from the start of the keys */
+	uint64_t key;
+	uint32_t value;
+	uint32_t padding;
+};
+
+struct hash_table_image {
+	void *mapping;
+	size_t bytes;
+	hash_function_t hash;
+	uint64_t mask;
+	uint64_t buckets;
+	uint64_t entries;
+	const uint64_t *first;
+	const struct image_entry *entry;
+	const char *keys;
+};
+
+static size_t align_8(size_t size)
+{
+	return (size + 7) & ~(size_t) 7;
+}
+
+static size_t image_bytes(const struct image_header *header)
+{
+	return sizeof(struct image_header)
+	       + (header->buckets + 1) * sizeof(uint64_t)
+	       + header->entries * sizeof(struct image_entry)
+	       + align_8(header->key_bytes);
+}
+
+/* About one entry per bucket, so a lookup mostly reads a single entry */
+static uint64_t image_buckets(size_t entries)
+{
+	uint64_t buckets = 1;
+	while (buckets < entries) {
+		buckets *= 2;
+	}
+	return buckets;
+}
+
+/* Every entry of the table, hashed, in one array, and their keys one
+   after the other in *KEYS.  Keys are copied as they come, since the
+   cursor only keeps them until the next call. */
+static struct image_entry *collect_entries(void *hash_table,
+                                           hash_table_next_t next,
+                                           size_t buckets,
+                                           hash_function_t hash,
+                                           size_t *entries,
+                                           char **keys,
+                                           uint64_t *key_bytes)
+{
+	size_t capacity = 1024;
+	struct image_entry *saved = malloc(capacity * sizeof(struct image_entry));
+	size_t keys_capacity = 16 * capacity;
+	*keys = malloc(keys_capacity);
+	assert(saved != NULL && *keys != NULL);
+	*entries = 0;
+	*key_bytes = 0;
+	struct hash_table_cursor cursor = { .bucket = 0, .end = buckets };
+	const char *key = NULL;
+	uint32_t value = 0;
+	while (next(hash_table, &cursor, &key, &value)) {
+		if (*entries == capacity) {
+			capacity *= 2;
+			saved = realloc(saved, capacity * sizeof(struct image_entry));
+			assert(saved != NULL);
+		}
+		struct hashed_key hashed_key = get_hashed_key(hash, key);
+		while (keys_capacity - *key_bytes < hashed_key.length + 1) {
+			keys_capacity *= 2;
+			*keys = realloc(*keys, keys_capacity);
+			assert(*keys != NULL);
+		}
+		memcpy(*keys + *key_bytes, key, hashed_key.length + 1);
+		saved[(*entries)++] = (struct image_entry) {
+			.hash = hashed_key.hash,
+			.length = hashed_key.length,
+			.key = *key_bytes,
+			.value = value,
+		};
+		*key_bytes += hashed_key.length + 1;
+	}
+	hash_table_cursor_release(&cursor);
+	return saved;
+}
+
+static int write_all(FILE *file, const void *data, size_t size)
+{
+	if (size != 0 && fwrite(data, size, 1, file) != 1) {
+		return errno != 0 ? errno : EIO;
+	}
+	return 0;
+}
+
+static int write_image(FILE *file,
+                       const struct image_header *header,
+                       const struct image_entry *saved,
+                       const char *keys)
+{
+	size_t buckets = header->buckets;
+	size_t entries = header->entries;
+	uint64_t mask = buckets - 1;
+
+	/* Counting sort by bucket: count, prefix sum, then place */
+	uint64_t *first = calloc(buckets + 1, sizeof(uint64_t));
+	struct image_entry *sorted = malloc((entries == 0 ? 1 : entries) * sizeof(struct image_entry));
+	assert(first != NULL && sorted != NULL);
+	for (size_t i = 0; i < entries; ++i) {
+		++first[(saved[i].hash & mask) + 1];
+	}
+	for (size_t i = 0; i < buckets; ++i) {
+		first[i + 1] += first[i];
+	}
+	uint64_t *fill = malloc(buckets * sizeof(uint64_t));
+	assert(fill != NULL);
+	memcpy(fill, first, buckets * sizeof(uint64_t));
+	for (size_t i = 0; i < entries; ++i) {
+		sorted[fill[saved[i].hash & mask]++] = saved[i];
+	}
+	free(fill);
+
+	int err = write_all(file, header, sizeof(struct image_header));
+	if (err == 0) {
+		err = write_all(file, first, (buckets + 1) * sizeof(uint64_t));
+	}
+	if (err == 0) {
+		err = write_all(file, sorted, entries * sizeof(struct image_entry));
+	}
+	/* Keys go in the order they were collected, which is what their
+	   offsets were worked out from */
+	if (err == 0) {
+		err = write_all(file, keys, header->key_bytes);
+	}
+	static const char padding[8];
+	if (err == 0) {
+		err = write_all(file, padding, align_8(header->key_bytes) - header->key_bytes);
+	}
+	free(sorted);
+	free(first);
+	return err;
+}
+
+/* Flush the directory entry of PATH to disk, so a rename to it survives a
+   crash along with the file's contents */
+static int sync_directory(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	char *directory = NULL;
+	if (slash == NULL) {
+		directory = strdup(".");
+	}
+	else {
+		size_t length = slash == path ? 1 : (size_t) (slash - path);
+		directory = strndup(path, length);
+	}
+	assert(directory != NULL);
+	int err = 0;
+	int fd = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1) {
+		err = errno;
+	}
+	else {
+		if (fsync(fd) != 0) {
+			err = errno;
+		}
+		close(fd);
+	}
+	free(directory);
+	return err;
+}
+
+int hash_table_image_save(const char *path,
+                          void *hash_table,
+                          hash_table_next_t next,
+                          size_t buckets)
+{
+	assert(path != NULL);
+	struct image_header header = {
+		.magic = IMAGE_MAGIC,
+		.version = IMAGE_VERSION,
+	};
+	while (hash_functions[header.hash].name != NULL
+	       && hash_functions[header.hash].hash != hash_table_options.hash) {
+		++header.hash;
+	}
+	if (hash_functions[header.hash].name == NULL) {
+		return EINVAL;
+	}
+
+	size_t entries = 0;
+	char *keys = NULL;
+	struct image_entry *saved = collect_entries(hash_table, next, buckets,
+	                                            hash_table_options.hash,
+	                                            &entries, &keys, &header.key_bytes);
+	header.entries = entries;
+	header.buckets = image_buckets(entries);
+
+	size_t length = strlen(path);
+	char *temporary = malloc(length + sizeof(".tmp"));
+	assert(temporary != NULL);
+	memcpy(temporary, path, length);
+	memcpy(temporary + length, ".tmp", sizeof(".tmp"));
+
+	int err = 0;
+	FILE *file = fopen(temporary, "wb");
+	if (file == NULL) {
+		err = errno;
+	}
+	else {
+		err = write_image(file, &header, saved, keys);
+		/* The contents have to be on disk before the rename is, or a
+		   crash could leave a truncated image under the real name */
+		if (err == 0 && (fflush(file) != 0 || fsync(fileno(file)) != 0)) {
+			err = errno;
+		}
+		if (fclose(file) != 0 && err == 0) {
+			err = errno;
+		}
+		if (err == 0 && rename(temporary, path) != 0) {
+			err = errno;
+		}
+		if (err != 0) {
+			unlink(temporary);
+		}
+		else {
+			err = sync_directory(path);
+		}
+	}
+	free(temporary);
+	free(saved);
+	free(keys);
+	return err;
+}
+
+struct hash_table_image *hash_table_image_open(const char *path)
+{
+	assert(path != NULL);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		return NULL;
+	}
+	struct stat stat;
+	if (fstat(fd, &stat) != 0) {
+		int err = errno;
+		close(fd);
+		errno = err;
+		return NULL;
+	}
+	size_t bytes = stat.st_size;
+	if (bytes < sizeof(struct image_header)) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	void *mapping = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0);
+	int err = errno;
+	/* The mapping keeps the file open */
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		errno = err;
+		return NULL;
+	}
+
+	const struct image_header *header = mapping;
+	size_t hash_functions_count = 0;
+	while (hash_functions[hash_functions_count].name != NULL) {
+		++hash_functions_count;
+	}
+	if (memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) != 0
+	    || header->version != IMAGE_VERSION
+	    || header->hash >= hash_functions_count
+	    || header->buckets == 0
+	    || (header->buckets & (header->buckets - 1)) != 0
+	    || header->buckets > bytes / sizeof(uint64_t)
+	    || header->entries > bytes / sizeof(struct image_entry)
+	    || header->key_bytes > bytes
+	    || image_bytes(header) != bytes) {
+		munmap(mapping, bytes);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct hash_table_image *image = calloc(1, sizeof(struct hash_table_image));
+	assert(image != NULL);
+	image->mapping = mapping;
+	image->bytes = bytes;
+	image->hash = hash_functions[header->hash].hash;
+	image->buckets = header->buckets;
+	image->mask = header->buckets - 1;
+	image->entries = header->entries;
+	image->first = (const uint64_t *) (header + 1);
+	image->entry = (const struct image_entry *) (image->first + header->buckets + 1);
+	image->keys = (const char *) (image->entry + header->entries);
+	return image;
+}
+
+static const struct image_entry *get_image_entry(struct hash_table_image *image,
+                                                 const char *key)
+{
+	assert(key != NULL);
+	struct hashed_key hashed_key = get_hashed_key(image->hash, key);
+	uint64_t bucket = hashed_key.hash & image->mask;
+	uint64_t nodes = 0;
+	uint64_t key_compares = 0;
+	const struct image_entry *found = NULL;
+	for (uint64_t i = image->first[bucket]; i < image->first[bucket + 1]; ++i) {
+		const struct image_entry *entry = &image->entry[i];
+		++nodes;
+		if (entry->hash == hashed_key.hash && entry->length == hashed_key.length) {
+			++key_compares;
+			if (memcmp(image->keys + entry->key, key, hashed_key.length) == 0) {
+				found = entry;
+				break;
+			}
+		}
+	}
+	count_lookup(nodes, key_compares);
+	return found;
+}
+
+bool hash_table_image_contains(struct hash_table_image *image,
+                               const char *key)
+{
+	return get_image_entry(image, key) != NULL;
+}
+
+uint32_t hash_table_image_get_value(struct hash_table_image *image,
+                                    const char *key)
+{
+	const struct image_entry *entry = get_image_entry(image, key);
+	assert(entry != NULL);
+	return entry->value;
+}
+
+size_t hash_table_image_size(struct hash_table_image *image)
+{
+	return image->entries;
+}
+
+size_t hash_table_image_bytes(struct hash_table_image *image)
+{
+	return image->bytes;
+}
+
+size_t hash_table_image_buckets(struct hash_table_image *image)
+{
+	return image->buckets;
+}
+
+bool hash_table_image_next(struct hash_table_image *image,
+                           struct hash_table_cursor *cursor,
+                           const char **key,
+                           uint32_t *value)
+{
+	while (cursor->bucket < cursor->end && cursor->bucket < image->buckets) {
+		uint64_t i = image->first[cursor->bucket] + cursor->position;
+		if (i < image->first[cursor->bucket + 1]) {
+			*key = image->keys + image->entry[i].key;
+			*value = image->entry[i].value;
+			++cursor->position;
+			return true;
+		}
+		++cursor->bucket;
+		cursor->position = 0;
+	}
+	return false;
+}
+
+void hash_table_image_close(struct hash_table_image *image)
+{
+	munmap(image->mapping, image->bytes);
+	free(image);
+}
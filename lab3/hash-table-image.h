@@ -0,0 +1,45 @@
+#pragma once
+
+#include "hash-table-common.h"
+#include "hash-table-scan.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A read-only table mapped straight from a file written by
+   hash_table_image_save.  The file holds offsets instead of pointers, so
+   opening it is a single mmap however many entries it has, and its pages
+   are only read in (and shared between processes) as lookups touch them.
+   The file has to stay unchanged while it is open. */
+struct hash_table_image;
+
+/* Write every entry of HASH_TABLE (as returned by NEXT for buckets 0 up to
+   BUCKETS) to an image at PATH, hashed with hash_table_options.hash.  The
+   table must not change while it is saved.  The image is written to a
+   temporary file that is renamed to PATH at the end, so an image that
+   already is at PATH is replaced whole.  Returns 0 or an errno value. */
+int hash_table_image_save(const char *path,
+                          void *hash_table,
+                          hash_table_next_t next,
+                          size_t buckets);
+/* Map the image at PATH, or return NULL and set errno.  Only the header is
+   checked, so images have to come from a trusted source. */
+struct hash_table_image *hash_table_image_open(const char *path);
+bool hash_table_image_contains(struct hash_table_image *image,
+                               const char *key);
+uint32_t hash_table_image_get_value(struct hash_table_image *image,
+                                    const char *key);
+/* Number of entries in the image */
+size_t hash_table_image_size(struct hash_table_image *image);
+/* Size of the image file in bytes */
+size_t hash_table_image_bytes(struct hash_table_image *image);
+/* Number of buckets, for iterating with struct hash_table_cursor */
+size_t hash_table_image_buckets(struct hash_table_image *image);
+/* Return the next entry of CURSOR's buckets in KEY and VALUE, or false once
+   there are none left.  KEY points into the mapping. */
+bool hash_table_image_next(struct hash_table_image *image,
+                           struct hash_table_cursor *cursor,
+                           const char **key,
+                           uint32_t *value);
+void hash_table_image_close(struct hash_table_image *image);
@@ -0,0 +1,52 @@
+#include "hash-table-instrument.h"
+
+#ifdef HASH_TABLE_INSTRUMENT
+
+#include <assert.h>
+#include <string.h>
+
+void instrument_report_lock(struct instrument_report *report,
+                            const char *name,
+                            struct lock_stats *stats)
+{
+	size_t i = 0;
+	while (i < report->lock_count && strcmp(report->locks[i].name, name) != 0) {
+		++i;
+	}
+	if (i == report->lock_count) {
+		assert(report->lock_count < INSTRUMENT_LOCKS);
+		report->locks[report->lock_count++].name = name;
+	}
+	report->locks[i].acquisitions += atomic_load(&stats->acquisitions);
+	report->locks[i].contended += atomic_load(&stats->contended);
+	report->locks[i].wait_nsec += atomic_load(&stats->wait_nsec);
+}
+
+void instrument_report_bucket(struct instrument_report *report,
+                              size_t index,
+                              size_t length,
+                              struct bucket_stats *stats)
+{
+	uint64_t hits = atomic_load(&stats->hits);
+	++report->buckets;
+	report->hits += hits;
+	report->chain_lengths[length < INSTRUMENT_CHAIN_LENGTHS
+	                      ? length
+	                      : INSTRUMENT_CHAIN_LENGTHS - 1] += 1;
+
+	/* Keep the busiest buckets sorted, most hits first */
+	size_t i = INSTRUMENT_HOT_BUCKETS;
+	while (i > 0 && report->hot[i - 1].hits < hits) {
+		if (i < INSTRUMENT_HOT_BUCKETS) {
+			report->hot[i] = report->hot[i - 1];
+		}
+		--i;
+	}
+	if (i < INSTRUMENT_HOT_BUCKETS) {
+		report->hot[i].index = index;
+		report->hot[i].length = length;
+		report->hot[i].hits = hits;
+	}
+}
+
+#endif
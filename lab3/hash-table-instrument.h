@@ -0,0 +1,141 @@
+#pragma once
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Optional counters for finding out why a table does not scale: how often
+   each lock is taken and waited for, and how long and how busy each bucket
+   is.  They are only compiled in with make INSTRUMENT=1, which defines
+   HASH_TABLE_INSTRUMENT.  Without it the structs below are empty and every
+   hook is an empty inline function, so the tables are exactly what they
+   would be without them. */
+
+struct lock_stats {
+#ifdef HASH_TABLE_INSTRUMENT
+	_Atomic uint64_t acquisitions;
+	/* Acquisitions that found the lock already held */
+	_Atomic uint64_t contended;
+	/* Total time contended acquisitions spent waiting */
+	_Atomic uint64_t wait_nsec;
+#endif
+};
+
+struct bucket_stats {
+#ifdef HASH_TABLE_INSTRUMENT
+	/* Adds, lookups and removes that went to this bucket */
+	_Atomic uint64_t hits;
+#endif
+};
+
+#ifdef HASH_TABLE_INSTRUMENT
+
+static inline uint64_t instrument_nsec(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static inline void count_acquisition(struct lock_stats *stats, uint64_t wait_start)
+{
+	atomic_fetch_add_explicit(&stats->acquisitions, 1, memory_order_relaxed);
+	if (wait_start != 0) {
+		atomic_fetch_add_explicit(&stats->contended, 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&stats->wait_nsec, instrument_nsec() - wait_start,
+		                          memory_order_relaxed);
+	}
+}
+
+#endif
+
+/* Drop-in replacement for pthread_rwlock_rdlock and pthread_rwlock_wrlock.
+   A try-lock first tells contended acquisitions apart from free ones, and
+   only those are timed. */
+static inline int instrument_rwlock_lock(pthread_rwlock_t *lock,
+                                         bool exclusive,
+                                         struct lock_stats *stats)
+{
+#ifdef HASH_TABLE_INSTRUMENT
+	uint64_t wait_start = 0;
+	int err = exclusive ? pthread_rwlock_trywrlock(lock) : pthread_rwlock_tryrdlock(lock);
+	if (err == EBUSY) {
+		wait_start = instrument_nsec();
+		err = exclusive ? pthread_rwlock_wrlock(lock) : pthread_rwlock_rdlock(lock);
+	}
+	if (err == 0) {
+		count_acquisition(stats, wait_start);
+	}
+	return err;
+#else
+	(void) stats;
+	return exclusive ? pthread_rwlock_wrlock(lock) : pthread_rwlock_rdlock(lock);
+#endif
+}
+
+static inline void count_bucket_hit(struct bucket_stats *stats)
+{
+#ifdef HASH_TABLE_INSTRUMENT
+	atomic_fetch_add_explicit(&stats->hits, 1, memory_order_relaxed);
+#else
+	(void) stats;
+#endif
+}
+
+/* Add FROM's counts to INTO, for bucket locks that are about to be freed */
+static inline void merge_lock_stats(struct lock_stats *into, struct lock_stats *from)
+{
+#ifdef HASH_TABLE_INSTRUMENT
+	atomic_fetch_add(&into->acquisitions, atomic_load(&from->acquisitions));
+	atomic_fetch_add(&into->contended, atomic_load(&from->contended));
+	atomic_fetch_add(&into->wait_nsec, atomic_load(&from->wait_nsec));
+#else
+	(void) into;
+	(void) from;
+#endif
+}
+
+#ifdef HASH_TABLE_INSTRUMENT
+
+/* Chains this long or longer share the histogram's last slot */
+#define INSTRUMENT_CHAIN_LENGTHS 16
+/* Number of busiest buckets a report keeps */
+#define INSTRUMENT_HOT_BUCKETS 4
+#define INSTRUMENT_LOCKS 4
+
+/* A summary of one table's counters, filled in by its _instrument
+   function.  Those add to whatever the report already holds, so a table
+   made of sub-tables can pass the same report to each of them. */
+struct instrument_report {
+	struct {
+		const char *name;
+		uint64_t acquisitions;
+		uint64_t contended;
+		uint64_t wait_nsec;
+	} locks[INSTRUMENT_LOCKS];
+	size_t lock_count;
+	size_t buckets;
+	uint64_t hits;
+	size_t chain_lengths[INSTRUMENT_CHAIN_LENGTHS];
+	struct {
+		size_t index;
+		size_t length;
+		uint64_t hits;
+	} hot[INSTRUMENT_HOT_BUCKETS];
+};
+
+/* Add STATS to the lock called NAME, which is created if it is new */
+void instrument_report_lock(struct instrument_report *report,
+                            const char *name,
+                            struct lock_stats *stats);
+/* Count bucket INDEX with a chain LENGTH long */
+void instrument_report_bucket(struct instrument_report *report,
+                              size_t index,
+                              size_t length,
+                              struct bucket_stats *stats);
+
+#endif
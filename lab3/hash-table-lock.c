@@ -0,0 +1,180 @@
+#include "hash-table-lock.h"
+
+#include <sched.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+/* Checks of the lock word before parking, doubling the pause in between
+   each time up to ADAPTIVE_MAX_BACKOFF pauses */
+#define ADAPTIVE_SPINS 16
+#define ADAPTIVE_MAX_BACKOFF 64
+
+/* Transactions started before giving up and taking the lock for real */
+#define ELISION_ATTEMPTS 3
+
+/* Explicit abort code for finding the lock held inside a transaction */
+#define ELISION_LOCK_HELD 0xff
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ volatile("yield");
+#endif
+}
+
+void hash_table_lock_init(struct hash_table_lock *lock, enum hash_table_lock_kind kind)
+{
+	lock->kind = kind;
+	if (kind == HASH_TABLE_LOCK_MUTEX) {
+		int err = pthread_mutex_init(&lock->mutex, NULL);
+		if (err != 0) {
+			exit(err);
+		}
+	}
+	else {
+		atomic_init(&lock->state, 0);
+	}
+}
+
+void hash_table_lock_destroy(struct hash_table_lock *lock)
+{
+	if (lock->kind == HASH_TABLE_LOCK_MUTEX) {
+		int err = pthread_mutex_destroy(&lock->mutex);
+		if (err != 0) {
+			exit(err);
+		}
+	}
+}
+
+/* Spin first, then park until the state goes back to 0.  A thread that
+   parks sets the state to 2 and keeps it there once it gets the lock,
+   since it cannot know if others are still parked; the cost is at most one
+   needless wake up. */
+void adaptive_lock_wait(struct hash_table_lock *lock)
+{
+	uint32_t backoff = 1;
+	for (uint32_t i = 0; i < ADAPTIVE_SPINS; ++i) {
+		for (uint32_t j = 0; j < backoff; ++j) {
+			cpu_relax();
+		}
+		if (backoff < ADAPTIVE_MAX_BACKOFF) {
+			backoff *= 2;
+		}
+		if (atomic_load_explicit(&lock->state, memory_order_relaxed) == 0
+		    && hash_table_lock_try(lock)) {
+			return;
+		}
+	}
+
+	while (atomic_exchange_explicit(&lock->state, 2, memory_order_acquire) != 0) {
+#ifdef __linux__
+		syscall(SYS_futex, &lock->state, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+#else
+		sched_yield();
+#endif
+	}
+}
+
+void adaptive_lock_wake(struct hash_table_lock *lock)
+{
+#ifdef __linux__
+	syscall(SYS_futex, &lock->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+	(void) lock;
+#endif
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+static bool has_rtm(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+		return false;
+	}
+	return (ebx & bit_RTM) != 0;
+}
+
+bool hash_table_lock_elision_supported(void)
+{
+	static _Atomic int supported = -1;
+	int result = atomic_load_explicit(&supported, memory_order_relaxed);
+	if (result < 0) {
+		result = has_rtm();
+		atomic_store_explicit(&supported, result, memory_order_relaxed);
+	}
+	return result;
+}
+
+/* Reading the lock word puts it in the transaction's read set, so a thread
+   that takes the lock for real aborts every transaction running under it */
+__attribute__((target("rtm")))
+bool elided_lock_begin(struct hash_table_lock *lock)
+{
+	if (!hash_table_lock_elision_supported()) {
+		return false;
+	}
+	for (int attempt = 0; attempt < ELISION_ATTEMPTS; ++attempt) {
+		unsigned int status = _xbegin();
+		if (status == _XBEGIN_STARTED) {
+			if (atomic_load_explicit(&lock->state, memory_order_relaxed) == 0) {
+				return true;
+			}
+			_xabort(ELISION_LOCK_HELD);
+		}
+		if ((status & _XABORT_EXPLICIT) && _XABORT_CODE(status) == ELISION_LOCK_HELD) {
+			/* Let the holder finish rather than aborting on it again */
+			while (atomic_load_explicit(&lock->state, memory_order_relaxed) != 0) {
+				cpu_relax();
+			}
+		}
+		else if (!(status & _XABORT_RETRY)) {
+			/* Capacity overflows, system calls and the like abort every time */
+			return false;
+		}
+	}
+	return false;
+}
+
+__attribute__((target("rtm")))
+bool elided_lock_end(struct hash_table_lock *lock)
+{
+	(void) lock;
+	if (!hash_table_lock_elision_supported() || !_xtest()) {
+		return false;
+	}
+	_xend();
+	return true;
+}
+
+#else
+
+bool hash_table_lock_elision_supported(void)
+{
+	return false;
+}
+
+bool elided_lock_begin(struct hash_table_lock *lock)
+{
+	(void) lock;
+	return false;
+}
+
+bool elided_lock_end(struct hash_table_lock *lock)
+{
+	(void) lock;
+	return false;
+}
+
+#endif
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "hash-table-common.h"
+#include "hash-table-instrument.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* A lock for critical sections of a handful of instructions, like the
+   bucket locks of v2.  Its kind (see hash-table-common.h) is picked when
+   it is initialized:
+
+   - HASH_TABLE_LOCK_MUTEX is a plain pthread mutex.
+   - HASH_TABLE_LOCK_ADAPTIVE spins on the lock word with exponential
+     backoff for a while, since the holder is usually about to let go, and
+     only then parks the thread in the kernel (a futex on Linux, otherwise
+     it keeps yielding).  Unlocking only makes a system call if some thread
+     may be parked.
+   - HASH_TABLE_LOCK_ELIDED runs the critical section as a hardware
+     transaction (Intel RTM) that only reads the lock word, so threads in
+     different parts of a bucket's chain, or of the table, do not write to
+     a shared line at all.  After a few aborts, or on CPUs without RTM, it
+     takes the adaptive lock instead. */
+struct hash_table_lock {
+	enum hash_table_lock_kind kind;
+	union {
+		pthread_mutex_t mutex;
+		/* 0 when free, 1 when held, 2 when held and a thread may be parked */
+		_Atomic uint32_t state;
+	};
+};
+
+void hash_table_lock_init(struct hash_table_lock *lock, enum hash_table_lock_kind kind);
+void hash_table_lock_destroy(struct hash_table_lock *lock);
+/* Whether this CPU can run HASH_TABLE_LOCK_ELIDED critical sections as
+   transactions, rather than always falling back to the adaptive lock */
+bool hash_table_lock_elision_supported(void);
+
+/* The slow paths, for when the lock word is not free straight away */
+void adaptive_lock_wait(struct hash_table_lock *lock);
+void adaptive_lock_wake(struct hash_table_lock *lock);
+bool elided_lock_begin(struct hash_table_lock *lock);
+bool elided_lock_end(struct hash_table_lock *lock);
+
+static inline bool hash_table_lock_try(struct hash_table_lock *lock)
+{
+	if (lock->kind == HASH_TABLE_LOCK_MUTEX) {
+		return pthread_mutex_trylock(&lock->mutex) == 0;
+	}
+	uint32_t expected = 0;
+	return atomic_compare_exchange_strong_explicit(&lock->state, &expected, 1,
+	                                               memory_order_acquire,
+	                                               memory_order_relaxed);
+}
+
+/* Counted in STATS when instrumented.  An elided acquisition counts as
+   uncontended, since the transaction cannot time itself. */
+static inline void hash_table_lock_acquire(struct hash_table_lock *lock,
+                                           struct lock_stats *stats)
+{
+	(void) stats;
+	if (lock->kind == HASH_TABLE_LOCK_ELIDED && elided_lock_begin(lock)) {
+#ifdef HASH_TABLE_INSTRUMENT
+		count_acquisition(stats, 0);
+#endif
+		return;
+	}
+	if (hash_table_lock_try(lock)) {
+#ifdef HASH_TABLE_INSTRUMENT
+		count_acquisition(stats, 0);
+#endif
+		return;
+	}
+#ifdef HASH_TABLE_INSTRUMENT
+	uint64_t wait_start = instrument_nsec();
+#endif
+	if (lock->kind == HASH_TABLE_LOCK_MUTEX) {
+		int err = pthread_mutex_lock(&lock->mutex);
+		if (err != 0) {
+			exit(err);
+		}
+	}
+	else {
+		adaptive_lock_wait(lock);
+	}
+#ifdef HASH_TABLE_INSTRUMENT
+	count_acquisition(stats, wait_start);
+#endif
+}
+
+static inline void hash_table_lock_release(struct hash_table_lock *lock)
+{
+	if (lock->kind == HASH_TABLE_LOCK_MUTEX) {
+		int err = pthread_mutex_unlock(&lock->mutex);
+		if (err != 0) {
+			exit(err);
+		}
+		return;
+	}
+	if (lock->kind == HASH_TABLE_LOCK_ELIDED && elided_lock_end(lock)) {
+		return;
+	}
+	if (atomic_exchange_explicit(&lock->state, 0, memory_order_release) == 2) {
+		adaptive_lock_wake(lock);
+	}
+}
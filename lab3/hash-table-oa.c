@@ -0,0 +1,259 @@
+#include "hash-table-oa.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Open addressing with linear probing.  Every slot lives in one flat array,
+   so a probe sequence walks consecutive memory instead of chasing list
+   pointers.  Slots are 16 bytes, so four share a cache line, and the full
+   hash is kept next to the key so almost every mismatch is rejected without
+   touching the key's memory at all.  Slots have no room for the key
+   itself, so a table that owns its keys keeps a copy of each. */
+
+/* Grow once the table is more than 3/4 full, which keeps probe sequences
+   short with linear probing */
+#define LOAD_FACTOR_NUMERATOR 3
+#define LOAD_FACTOR_DENOMINATOR 4
+
+struct slot {
+	uint32_t hash;
+	uint32_t value;
+	/* NULL marks an empty slot */
+	const char *key;
+};
+
+struct hash_table_oa {
+	hash_function_t hash;
+	/* Copy keys into the table instead of pointing at the caller's */
+	bool own_keys;
+	struct slot *slots;
+	/* Always a power of two */
+	size_t capacity;
+	size_t size;
+	/* log2(capacity), used to pick the index from the top hash bits */
+	unsigned int shift;
+};
+
+static struct slot *allocate_slots(size_t capacity)
+{
+	struct slot *slots = calloc(capacity, sizeof(struct slot));
+	assert(slots != NULL);
+	return slots;
+}
+
+struct hash_table_oa *hash_table_oa_create()
+{
+	struct hash_table_oa *hash_table = calloc(1, sizeof(struct hash_table_oa));
+	assert(hash_table != NULL);
+	hash_table->hash = hash_table_options.hash;
+	hash_table->own_keys = hash_table_options.own_keys;
+	hash_table->capacity = HASH_TABLE_CAPACITY;
+	hash_table->shift = __builtin_ctzl(HASH_TABLE_CAPACITY);
+	hash_table->slots = allocate_slots(hash_table->capacity);
+	return hash_table;
+}
+
+/* Fibonacci hashing: multiplying by 2^32 / phi and keeping the top bits
+   spreads the hash over the whole table even if its low bits are weak,
+   as they are with bernstein_hash */
+static size_t get_home_index(struct hash_table_oa *hash_table, uint32_t hash)
+{
+	return (uint32_t) (hash * 2654435769u) >> (32 - hash_table->shift);
+}
+
+/* Return the slot holding KEY, or the empty slot where it would go */
+static struct slot *find_slot(struct hash_table_oa *hash_table,
+                              const char *key,
+                              uint32_t hash)
+{
+	assert(key != NULL);
+	size_t mask = hash_table->capacity - 1;
+	size_t index = get_home_index(hash_table, hash);
+	struct slot *slot = NULL;
+	uint64_t nodes = 0;
+	uint64_t key_compares = 0;
+	while (true) {
+		slot = &hash_table->slots[index];
+		if (slot->key == NULL) {
+			break;
+		}
+		++nodes;
+		if (slot->hash == hash) {
+			++key_compares;
+			if (strcmp(slot->key, key) == 0) {
+				break;
+			}
+		}
+		index = (index + 1) & mask;
+	}
+	count_lookup(nodes, key_compares);
+	return slot;
+}
+
+static void grow(struct hash_table_oa *hash_table)
+{
+	struct slot *old_slots = hash_table->slots;
+	size_t old_capacity = hash_table->capacity;
+
+	hash_table->capacity = old_capacity * 2;
+	hash_table->shift += 1;
+	hash_table->slots = allocate_slots(hash_table->capacity);
+
+	/* Every key is distinct, so the first empty slot is always the spot */
+	size_t mask = hash_table->capacity - 1;
+	for (size_t i = 0; i < old_capacity; ++i) {
+		struct slot *old_slot = &old_slots[i];
+		if (old_slot->key == NULL) {
+			continue;
+		}
+		size_t index = get_home_index(hash_table, old_slot->hash);
+		while (hash_table->slots[index].key != NULL) {
+			index = (index + 1) & mask;
+		}
+		hash_table->slots[index] = *old_slot;
+	}
+	free(old_slots);
+}
+
+bool hash_table_oa_contains(struct hash_table_oa *hash_table,
+                            const char *key)
+{
+	struct slot *slot = find_slot(hash_table, key, hash_key(hash_table->hash, key));
+	return slot->key != NULL;
+}
+
+static void add_hashed_entry(struct hash_table_oa *hash_table,
+                             const char *key,
+                             uint32_t hash,
+                             uint32_t value)
+{
+	struct slot *slot = find_slot(hash_table, key, hash);
+
+	/* Update the value if it already exists */
+	if (slot->key != NULL) {
+		slot->value = value;
+		return;
+	}
+
+	if ((hash_table->size + 1) * LOAD_FACTOR_DENOMINATOR
+	    > hash_table->capacity * LOAD_FACTOR_NUMERATOR) {
+		grow(hash_table);
+		slot = find_slot(hash_table, key, hash);
+	}
+
+	if (hash_table->own_keys) {
+		size_t size = strlen(key) + 1;
+		char *copy = malloc(size);
+		assert(copy != NULL);
+		key = memcpy(copy, key, size);
+	}
+	slot->hash = hash;
+	slot->key = key;
+	slot->value = value;
+	++hash_table->size;
+}
+
+void hash_table_oa_add_entry(struct hash_table_oa *hash_table,
+                             const char *key,
+                             uint32_t value)
+{
+	add_hashed_entry(hash_table, key, hash_key(hash_table->hash, key), value);
+}
+
+/* Hash the whole batch and prefetch every home slot before probing any of
+   them, so the misses overlap */
+void hash_table_oa_add_batch(struct hash_table_oa *hash_table,
+                             const char **keys,
+                             const uint32_t *values,
+                             size_t n)
+{
+	uint32_t hashes[HASH_TABLE_BATCH];
+	for (size_t start = 0; start < n; start += HASH_TABLE_BATCH) {
+		size_t count = n - start < HASH_TABLE_BATCH ? n - start : HASH_TABLE_BATCH;
+		for (size_t i = 0; i < count; ++i) {
+			hashes[i] = hash_key(hash_table->hash, keys[start + i]);
+			size_t index = get_home_index(hash_table, hashes[i]);
+			__builtin_prefetch(&hash_table->slots[index], 1);
+		}
+		for (size_t i = 0; i < count; ++i) {
+			add_hashed_entry(hash_table, keys[start + i], hashes[i], values[start + i]);
+		}
+	}
+}
+
+uint32_t hash_table_oa_get_value(struct hash_table_oa *hash_table,
+                                 const char *key)
+{
+	struct slot *slot = find_slot(hash_table, key, hash_key(hash_table->hash, key));
+	assert(slot->key != NULL);
+	return slot->value;
+}
+
+/* Removing leaves no tombstone.  Instead every following slot in the run
+   that would still be reachable from its home slot through the hole is
+   shifted back into it, so lookups can keep stopping at the first empty
+   slot. */
+bool hash_table_oa_remove(struct hash_table_oa *hash_table,
+                          const char *key)
+{
+	struct slot *slot = find_slot(hash_table, key, hash_key(hash_table->hash, key));
+	if (slot->key == NULL) {
+		return false;
+	}
+	if (hash_table->own_keys) {
+		free((char *) slot->key);
+	}
+
+	size_t mask = hash_table->capacity - 1;
+	size_t hole = slot - hash_table->slots;
+	size_t index = hole;
+	while (true) {
+		index = (index + 1) & mask;
+		struct slot *next = &hash_table->slots[index];
+		if (next->key == NULL) {
+			break;
+		}
+		/* Distance from the home slot to the hole and to where it is now */
+		size_t home = get_home_index(hash_table, next->hash);
+		if (((hole - home) & mask) < ((index - home) & mask)) {
+			hash_table->slots[hole] = *next;
+			hole = index;
+		}
+	}
+	hash_table->slots[hole] = (struct slot) { 0 };
+	--hash_table->size;
+	return true;
+}
+
+size_t hash_table_oa_buckets(struct hash_table_oa *hash_table)
+{
+	return hash_table->capacity;
+}
+
+/* Every slot is a bucket of at most one entry */
+bool hash_table_oa_next(struct hash_table_oa *hash_table,
+                        struct hash_table_cursor *cursor,
+                        const char **key,
+                        uint32_t *value)
+{
+	size_t end = cursor->end < hash_table->capacity ? cursor->end : hash_table->capacity;
+	while (cursor->bucket < end) {
+		struct slot *slot = &hash_table->slots[cursor->bucket++];
+		if (slot->key != NULL) {
+			*key = slot->key;
+			*value = slot->value;
+			return true;
+		}
+	}
+	return false;
+}
+
+void hash_table_oa_destroy(struct hash_table_oa *hash_table)
+{
+	for (size_t i = 0; hash_table->own_keys && i < hash_table->capacity; ++i) {
+		free((char *) hash_table->slots[i].key);
+	}
+	free(hash_table->slots);
+	free(hash_table);
+}
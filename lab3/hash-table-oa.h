@@ -0,0 +1,33 @@
+#pragma once
+
+#include "hash-table-common.h"
+
+#include <stdbool.h>
+
+/* An open addressing table.  Like hash_table_base it is not thread safe. */
+struct hash_table_oa;
+struct hash_table_oa *hash_table_oa_create();
+void hash_table_oa_add_entry(struct hash_table_oa *hash_table,
+                             const char *key,
+                             uint32_t value);
+/* Same as calling add_entry for each of the N keys in turn */
+void hash_table_oa_add_batch(struct hash_table_oa *hash_table,
+                             const char **keys,
+                             const uint32_t *values,
+                             size_t n);
+bool hash_table_oa_contains(struct hash_table_oa *hash_table,
+                            const char *key);
+uint32_t hash_table_oa_get_value(struct hash_table_oa *hash_table,
+                                 const char* key);
+bool hash_table_oa_remove(struct hash_table_oa *hash_table,
+                          const char *key);
+void hash_table_oa_destroy(struct hash_table_oa *hash_table);
+/* Number of buckets, for iterating with struct hash_table_cursor */
+size_t hash_table_oa_buckets(struct hash_table_oa *hash_table);
+/* Return the next entry of CURSOR's buckets in KEY and VALUE, or false once
+   there are none left.  Entries added or removed during the iteration may
+   or may not be returned. */
+bool hash_table_oa_next(struct hash_table_oa *hash_table,
+                        struct hash_table_cursor *cursor,
+                        const char **key,
+                        uint32_t *value);
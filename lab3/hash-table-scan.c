@@ -0,0 +1,70 @@
+#include "hash-table-scan.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+struct scan_worker {
+	pthread_t thread;
+	void *hash_table;
+	hash_table_next_t next;
+	struct hash_table_cursor cursor;
+	hash_table_visit_t visit;
+	void *context;
+	size_t visited;
+};
+
+static void *scan_range(void *arg)
+{
+	struct scan_worker *worker = arg;
+	const char *key = NULL;
+	uint32_t value = 0;
+	while (worker->next(worker->hash_table, &worker->cursor, &key, &value)) {
+		worker->visit(worker->context, key, value);
+		++worker->visited;
+	}
+	hash_table_cursor_release(&worker->cursor);
+	return NULL;
+}
+
+size_t hash_table_scan(void *hash_table,
+                       hash_table_next_t next,
+                       size_t buckets,
+                       uint32_t threads,
+                       hash_table_visit_t visit,
+                       void *context)
+{
+	if (threads == 0) {
+		threads = 1;
+	}
+	struct scan_worker *workers = calloc(threads, sizeof(struct scan_worker));
+	assert(workers != NULL);
+
+	/* Contiguous ranges, so each thread walks its buckets in memory order */
+	for (uint32_t i = 0; i < threads; ++i) {
+		struct scan_worker *worker = &workers[i];
+		worker->hash_table = hash_table;
+		worker->next = next;
+		worker->cursor = (struct hash_table_cursor) {
+			.bucket = buckets * i / threads,
+			.end = buckets * (i + 1) / threads,
+		};
+		worker->visit = visit;
+		worker->context = context;
+		int err = pthread_create(&worker->thread, NULL, scan_range, worker);
+		if (err != 0) {
+			exit(err);
+		}
+	}
+
+	size_t visited = 0;
+	for (uint32_t i = 0; i < threads; ++i) {
+		int err = pthread_join(workers[i].thread, NULL);
+		if (err != 0) {
+			exit(err);
+		}
+		visited += workers[i].visited;
+	}
+	free(workers);
+	return visited;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "hash-table-common.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A table's (or snapshot's) _next function.  The key it returns may only
+   be valid until the next call with the same cursor. */
+typedef bool (*hash_table_next_t)(void *hash_table,
+                                  struct hash_table_cursor *cursor,
+                                  const char **key,
+                                  uint32_t *value);
+
+/* Split buckets 0 up to BUCKETS of HASH_TABLE into THREADS ranges and have
+   a thread per range call NEXT until it runs out, and VISIT for every
+   entry it returns.  VISIT is called from all of the threads at once.
+   Returns how many entries were visited. */
+size_t hash_table_scan(void *hash_table,
+                       hash_table_next_t next,
+                       size_t buckets,
+                       uint32_t threads,
+                       hash_table_visit_t visit,
+                       void *context);
@@ -0,0 +1,217 @@
+#include "hash-table-sharded.h"
+
+#include "hash-table-cpu.h"
+#include "hash-table-v2.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include <pthread.h>
+
+/* A front end splitting the key space over independent v2 tables.  Each
+   shard has its own bucket array, size counters, arena and epoch, so
+   threads working on different shards share no cache lines at all.  The
+   shard is picked from the top bits of the hash, while v2 picks buckets
+   from the low bits, so keys spread evenly inside each shard too.
+
+   Every shard is created by a thread pinned to its own CPU (round robin
+   over the CPUs the process may run on).  Creating a shard writes its
+   initial bucket array, so with the usual first-touch policy that array
+   ends up in memory local to that CPU's socket.  The arrays a shard grows
+   into later are allocated and first written by whichever writer starts
+   the resize, so they land wherever that thread runs. */
+
+struct hash_table_sharded {
+	hash_function_t hash;
+	uint32_t shard_count;
+	struct hash_table_v2 **shards;
+};
+
+struct shard_creation {
+	struct hash_table_sharded *hash_table;
+	uint32_t index;
+};
+
+static void *create_shard(void *arg)
+{
+	struct shard_creation *creation = arg;
+	creation->hash_table->shards[creation->index] = hash_table_v2_create();
+	return NULL;
+}
+
+struct hash_table_sharded *hash_table_sharded_create()
+{
+	struct hash_table_sharded *hash_table = calloc(1, sizeof(struct hash_table_sharded));
+	assert(hash_table != NULL);
+	hash_table->hash = hash_table_options.hash;
+	hash_table->shard_count = hash_table_options.shards != 0 ? hash_table_options.shards
+	                                                         : count_cpus();
+	hash_table->shards = calloc(hash_table->shard_count, sizeof(struct hash_table_v2 *));
+	struct shard_creation *creations = calloc(hash_table->shard_count,
+	                                          sizeof(struct shard_creation));
+	pthread_t *threads = calloc(hash_table->shard_count, sizeof(pthread_t));
+	assert(hash_table->shards != NULL && creations != NULL && threads != NULL);
+
+	for (uint32_t i = 0; i < hash_table->shard_count; ++i) {
+		creations[i] = (struct shard_creation) { hash_table, i };
+		pthread_attr_t attr;
+		int err = pthread_attr_init(&attr);
+		if (err != 0) {
+			exit(err);
+		}
+		pin_to_cpu(&attr, i);
+		err = pthread_create(&threads[i], &attr, create_shard, &creations[i]);
+		if (err != 0) {
+			exit(err);
+		}
+		pthread_attr_destroy(&attr);
+	}
+	for (uint32_t i = 0; i < hash_table->shard_count; ++i) {
+		int err = pthread_join(threads[i], NULL);
+		if (err != 0) {
+			exit(err);
+		}
+	}
+
+	free(threads);
+	free(creations);
+	return hash_table;
+}
+
+static uint32_t get_shard_index(struct hash_table_sharded *hash_table, uint32_t hash)
+{
+	return ((uint64_t) hash * hash_table->shard_count) >> 32;
+}
+
+static struct hash_table_v2 *get_shard(struct hash_table_sharded *hash_table, uint32_t hash)
+{
+	return hash_table->shards[get_shard_index(hash_table, hash)];
+}
+
+void hash_table_sharded_add_entry(struct hash_table_sharded *hash_table,
+                                  const char *key,
+                                  uint32_t value)
+{
+	assert(key != NULL);
+	struct hashed_key hashed_key = get_hashed_key(hash_table->hash, key);
+	hash_table_v2_add_hashed(get_shard(hash_table, hashed_key.hash), &hashed_key, value);
+}
+
+/* Split each group of keys by shard, keeping their order, and hand every
+   shard its keys in a single add_batch.  Keys are hashed once, here, and
+   the shards are given the hashes. */
+void hash_table_sharded_add_batch(struct hash_table_sharded *hash_table,
+                                  const char **keys,
+                                  const uint32_t *values,
+                                  size_t n)
+{
+	struct hashed_key hashed_keys[HASH_TABLE_BATCH];
+	uint32_t shard_indexes[HASH_TABLE_BATCH];
+	struct hashed_key shard_keys[HASH_TABLE_BATCH];
+	uint32_t shard_values[HASH_TABLE_BATCH];
+	bool done[HASH_TABLE_BATCH];
+
+	for (size_t start = 0; start < n; start += HASH_TABLE_BATCH) {
+		size_t count = n - start < HASH_TABLE_BATCH ? n - start : HASH_TABLE_BATCH;
+		for (size_t i = 0; i < count; ++i) {
+			assert(keys[start + i] != NULL);
+			hashed_keys[i] = get_hashed_key(hash_table->hash, keys[start + i]);
+			shard_indexes[i] = get_shard_index(hash_table, hashed_keys[i].hash);
+			done[i] = false;
+		}
+		for (size_t i = 0; i < count; ++i) {
+			if (done[i]) {
+				continue;
+			}
+			size_t shard_count = 0;
+			for (size_t j = i; j < count; ++j) {
+				if (shard_indexes[j] == shard_indexes[i]) {
+					shard_keys[shard_count] = hashed_keys[j];
+					shard_values[shard_count] = values[start + j];
+					++shard_count;
+					done[j] = true;
+				}
+			}
+			hash_table_v2_add_batch_hashed(hash_table->shards[shard_indexes[i]],
+			                               shard_keys, shard_values, shard_count);
+		}
+	}
+}
+
+bool hash_table_sharded_contains(struct hash_table_sharded *hash_table,
+                                 const char *key)
+{
+	assert(key != NULL);
+	struct hashed_key hashed_key = get_hashed_key(hash_table->hash, key);
+	return hash_table_v2_contains_hashed(get_shard(hash_table, hashed_key.hash), &hashed_key);
+}
+
+uint32_t hash_table_sharded_get_value(struct hash_table_sharded *hash_table,
+                                      const char *key)
+{
+	assert(key != NULL);
+	struct hashed_key hashed_key = get_hashed_key(hash_table->hash, key);
+	return hash_table_v2_get_value_hashed(get_shard(hash_table, hashed_key.hash), &hashed_key);
+}
+
+bool hash_table_sharded_remove(struct hash_table_sharded *hash_table,
+                               const char *key)
+{
+	assert(key != NULL);
+	struct hashed_key hashed_key = get_hashed_key(hash_table->hash, key);
+	return hash_table_v2_remove_hashed(get_shard(hash_table, hashed_key.hash), &hashed_key);
+}
+
+uint32_t hash_table_sharded_shards(struct hash_table_sharded *hash_table)
+{
+	return hash_table->shard_count;
+}
+
+size_t hash_table_sharded_buckets(struct hash_table_sharded *hash_table)
+{
+	size_t buckets = 0;
+	for (uint32_t i = 0; i < hash_table->shard_count; ++i) {
+		buckets += hash_table_v2_buckets(hash_table->shards[i]);
+	}
+	return buckets;
+}
+
+/* Buckets are numbered through each shard in turn.  The shard fills this
+   cursor's copies directly, which may still be handed out after the
+   cursor has moved on to the next shard. */
+bool hash_table_sharded_next(struct hash_table_sharded *hash_table,
+                             struct hash_table_cursor *cursor,
+                             const char **key,
+                             uint32_t *value)
+{
+	if (hash_table_cursor_pop(cursor, key, value)) {
+		return true;
+	}
+	size_t first = 0;
+	for (uint32_t i = 0; i < hash_table->shard_count && cursor->bucket < cursor->end; ++i) {
+		size_t buckets = hash_table_v2_buckets(hash_table->shards[i]);
+		if (cursor->bucket < first + buckets) {
+			struct hash_table_cursor shard_cursor = *cursor;
+			shard_cursor.bucket = cursor->bucket - first;
+			shard_cursor.end = cursor->end - first < buckets ? cursor->end - first : buckets;
+			bool found = hash_table_v2_next(hash_table->shards[i], &shard_cursor, key, value);
+			shard_cursor.bucket += first;
+			shard_cursor.end = cursor->end;
+			*cursor = shard_cursor;
+			if (found) {
+				return true;
+			}
+		}
+		first += buckets;
+	}
+	return false;
+}
+
+void hash_table_sharded_destroy(struct hash_table_sharded *hash_table)
+{
+	for (uint32_t i = 0; i < hash_table->shard_count; ++i) {
+		hash_table_v2_destroy(hash_table->shards[i]);
+	}
+	free(hash_table->shards);
+	free(hash_table);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "hash-table-common.h"
+
+#include <stdbool.h>
+
+struct hash_table_sharded;
+struct hash_table_sharded *hash_table_sharded_create();
+void hash_table_sharded_add_entry(struct hash_table_sharded *hash_table,
+                                  const char *key,
+                                  uint32_t value);
+/* Same as calling add_entry for each of the N keys in turn */
+void hash_table_sharded_add_batch(struct hash_table_sharded *hash_table,
+                                  const char **keys,
+                                  const uint32_t *values,
+                                  size_t n);
+bool hash_table_sharded_contains(struct hash_table_sharded *hash_table,
+                                 const char *key);
+uint32_t hash_table_sharded_get_value(struct hash_table_sharded *hash_table,
+                                      const char* key);
+bool hash_table_sharded_remove(struct hash_table_sharded *hash_table,
+                               const char *key);
+void hash_table_sharded_destroy(struct hash_table_sharded *hash_table);
+/* Number of buckets, for iterating with struct hash_table_cursor */
+size_t hash_table_sharded_buckets(struct hash_table_sharded *hash_table);
+/* Return the next entry of CURSOR's buckets in KEY and VALUE, or false once
+   there are none left.  The same caveats as for hash_table_v2_next apply,
+   and there is no snapshot across shards. */
+bool hash_table_sharded_next(struct hash_table_sharded *hash_table,
+                             struct hash_table_cursor *cursor,
+                             const char **key,
+                             uint32_t *value);
+/* Number of sub-tables the table was created with */
+uint32_t hash_table_sharded_shards(struct hash_table_sharded *hash_table);
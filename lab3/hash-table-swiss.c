@@ -0,0 +1,340 @@
+#include "hash-table-swiss.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Open addressing in the style of Abseil's Swiss tables.  Slots come in
+   groups of 16, and next to the slot array is an array of control bytes,
+   one per slot: the top 7 bits of the slot's hash (its tag) if it is full,
+   or EMPTY or DELETED.  A lookup loads the 16 control bytes of a group and
+   compares all of them with its tag in one SSE2 instruction, so it only
+   reads the slots whose tags match, which for a key that is not there is
+   usually none.  A group with an EMPTY byte ends the probe sequence.
+   Groups are probed quadratically, so a cluster of full groups does not
+   keep growing the way a run of slots does with linear probing. */
+
+#define GROUP_SIZE 16
+
+#define EMPTY ((int8_t) -128)
+/* A removed entry, which lookups have to probe past */
+#define DELETED ((int8_t) -2)
+
+/* Rehash once more than 7/8 of the slots are full or deleted.  Checking a
+   whole group per step keeps probe sequences short even at this load. */
+#define LOAD_FACTOR_NUMERATOR 7
+#define LOAD_FACTOR_DENOMINATOR 8
+
+struct slot {
+	uint32_t hash;
+	uint32_t value;
+	/* NULL in an empty or deleted slot */
+	const char *key;
+};
+
+struct hash_table_swiss {
+	hash_function_t hash;
+	/* Copy keys into the table instead of pointing at the caller's */
+	bool own_keys;
+	/* One control byte per slot, 16 byte aligned so a group is one load */
+	int8_t *control;
+	struct slot *slots;
+	/* Slots, always a power of two and a multiple of GROUP_SIZE */
+	size_t capacity;
+	size_t size;
+	size_t deleted;
+	/* log2(capacity / GROUP_SIZE), used to pick the group from the top
+	   hash bits */
+	unsigned int shift;
+};
+
+#ifdef __SSE2__
+/* Bit i is set if control byte i of GROUP is BYTE */
+static inline uint32_t match_byte(const int8_t *group, int8_t byte)
+{
+	__m128i control = _mm_load_si128((const __m128i *) group);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8(byte)));
+}
+
+/* Bit i is set if slot i of GROUP is empty or deleted, the only control
+   bytes with their top bit set */
+static inline uint32_t match_free(const int8_t *group)
+{
+	return _mm_movemask_epi8(_mm_load_si128((const __m128i *) group));
+}
+#else
+static inline uint32_t match_byte(const int8_t *group, int8_t byte)
+{
+	uint32_t mask = 0;
+	for (int i = 0; i < GROUP_SIZE; ++i) {
+		mask |= (uint32_t) (group[i] == byte) << i;
+	}
+	return mask;
+}
+
+static inline uint32_t match_free(const int8_t *group)
+{
+	uint32_t mask = 0;
+	for (int i = 0; i < GROUP_SIZE; ++i) {
+		mask |= (uint32_t) (group[i] < 0) << i;
+	}
+	return mask;
+}
+#endif
+
+static inline int8_t get_tag(uint32_t hash)
+{
+	return hash >> 25;
+}
+
+/* Fibonacci hashing, as in hash-table-oa.c.  The tag comes from the top
+   bits of the hash itself, so it is independent of the group. */
+static size_t get_home_group(struct hash_table_swiss *hash_table, uint32_t hash)
+{
+	return (uint32_t) (hash * 2654435769u) >> (32 - hash_table->shift);
+}
+
+static void allocate(struct hash_table_swiss *hash_table, size_t capacity)
+{
+	hash_table->capacity = capacity;
+	hash_table->shift = __builtin_ctzl(capacity / GROUP_SIZE);
+	hash_table->control = aligned_alloc(GROUP_SIZE, capacity);
+	hash_table->slots = calloc(capacity, sizeof(struct slot));
+	assert(hash_table->control != NULL && hash_table->slots != NULL);
+	memset(hash_table->control, EMPTY, capacity);
+	hash_table->deleted = 0;
+}
+
+struct hash_table_swiss *hash_table_swiss_create()
+{
+	struct hash_table_swiss *hash_table = calloc(1, sizeof(struct hash_table_swiss));
+	assert(hash_table != NULL);
+	hash_table->hash = hash_table_options.hash;
+	hash_table->own_keys = hash_table_options.own_keys;
+	allocate(hash_table, HASH_TABLE_CAPACITY);
+	return hash_table;
+}
+
+/* Return the index of the slot holding KEY, or capacity if there is none.
+   The Nth group probed is N(N+1)/2 groups after the home group, which
+   visits every group since the group count is a power of two. */
+static size_t find_index(struct hash_table_swiss *hash_table,
+                         const char *key,
+                         uint32_t hash)
+{
+	assert(key != NULL);
+	int8_t tag = get_tag(hash);
+	size_t mask = hash_table->capacity / GROUP_SIZE - 1;
+	size_t group = get_home_group(hash_table, hash);
+	uint64_t nodes = 0;
+	uint64_t key_compares = 0;
+	size_t found = hash_table->capacity;
+	for (size_t step = 1; found == hash_table->capacity; ++step) {
+		const int8_t *control = &hash_table->control[group * GROUP_SIZE];
+		for (uint32_t matches = match_byte(control, tag);
+		     matches != 0;
+		     matches &= matches - 1) {
+			size_t index = group * GROUP_SIZE + __builtin_ctz(matches);
+			struct slot *slot = &hash_table->slots[index];
+			++nodes;
+			if (slot->hash == hash) {
+				++key_compares;
+				if (strcmp(slot->key, key) == 0) {
+					found = index;
+					break;
+				}
+			}
+		}
+		if (match_byte(control, EMPTY) != 0) {
+			break;
+		}
+		group = (group + step) & mask;
+	}
+	count_lookup(nodes, key_compares);
+	return found;
+}
+
+/* Index of the first empty or deleted slot on HASH's probe sequence, which
+   is where a new key with that hash goes */
+static size_t find_free_index(struct hash_table_swiss *hash_table, uint32_t hash)
+{
+	size_t mask = hash_table->capacity / GROUP_SIZE - 1;
+	size_t group = get_home_group(hash_table, hash);
+	for (size_t step = 1; ; ++step) {
+		uint32_t free = match_free(&hash_table->control[group * GROUP_SIZE]);
+		if (free != 0) {
+			return group * GROUP_SIZE + __builtin_ctz(free);
+		}
+		group = (group + step) & mask;
+	}
+}
+
+/* Move every entry into new arrays, twice the size unless most of what
+   filled the old ones was deleted slots */
+static void rehash(struct hash_table_swiss *hash_table)
+{
+	int8_t *old_control = hash_table->control;
+	struct slot *old_slots = hash_table->slots;
+	size_t old_capacity = hash_table->capacity;
+
+	size_t capacity = old_capacity;
+	if ((hash_table->size + 1) * 2 * LOAD_FACTOR_DENOMINATOR
+	    > old_capacity * LOAD_FACTOR_NUMERATOR) {
+		capacity *= 2;
+	}
+	allocate(hash_table, capacity);
+
+	/* Every key is distinct and there are no deleted slots yet, so the
+	   first free slot is always the spot */
+	for (size_t i = 0; i < old_capacity; ++i) {
+		if (old_control[i] < 0) {
+			continue;
+		}
+		size_t index = find_free_index(hash_table, old_slots[i].hash);
+		hash_table->control[index] = old_control[i];
+		hash_table->slots[index] = old_slots[i];
+	}
+	free(old_slots);
+	free(old_control);
+}
+
+bool hash_table_swiss_contains(struct hash_table_swiss *hash_table,
+                               const char *key)
+{
+	size_t index = find_index(hash_table, key, hash_key(hash_table->hash, key));
+	return index != hash_table->capacity;
+}
+
+static void add_hashed_entry(struct hash_table_swiss *hash_table,
+                             const char *key,
+                             uint32_t hash,
+                             uint32_t value)
+{
+	size_t index = find_index(hash_table, key, hash);
+
+	/* Update the value if it already exists */
+	if (index != hash_table->capacity) {
+		hash_table->slots[index].value = value;
+		return;
+	}
+
+	/* Deleted slots count too, since lookups have to probe past them */
+	if ((hash_table->size + hash_table->deleted + 1) * LOAD_FACTOR_DENOMINATOR
+	    > hash_table->capacity * LOAD_FACTOR_NUMERATOR) {
+		rehash(hash_table);
+	}
+
+	if (hash_table->own_keys) {
+		size_t size = strlen(key) + 1;
+		char *copy = malloc(size);
+		assert(copy != NULL);
+		key = memcpy(copy, key, size);
+	}
+	index = find_free_index(hash_table, hash);
+	if (hash_table->control[index] == DELETED) {
+		--hash_table->deleted;
+	}
+	hash_table->control[index] = get_tag(hash);
+	hash_table->slots[index] = (struct slot) { hash, value, key };
+	++hash_table->size;
+}
+
+void hash_table_swiss_add_entry(struct hash_table_swiss *hash_table,
+                                const char *key,
+                                uint32_t value)
+{
+	add_hashed_entry(hash_table, key, hash_key(hash_table->hash, key), value);
+}
+
+/* Hash the whole batch and prefetch every home group's control bytes
+   before probing any of them, so the misses overlap */
+void hash_table_swiss_add_batch(struct hash_table_swiss *hash_table,
+                                const char **keys,
+                                const uint32_t *values,
+                                size_t n)
+{
+	uint32_t hashes[HASH_TABLE_BATCH];
+	for (size_t start = 0; start < n; start += HASH_TABLE_BATCH) {
+		size_t count = n - start < HASH_TABLE_BATCH ? n - start : HASH_TABLE_BATCH;
+		for (size_t i = 0; i < count; ++i) {
+			hashes[i] = hash_key(hash_table->hash, keys[start + i]);
+			size_t group = get_home_group(hash_table, hashes[i]);
+			__builtin_prefetch(&hash_table->control[group * GROUP_SIZE], 1);
+		}
+		for (size_t i = 0; i < count; ++i) {
+			add_hashed_entry(hash_table, keys[start + i], hashes[i], values[start + i]);
+		}
+	}
+}
+
+uint32_t hash_table_swiss_get_value(struct hash_table_swiss *hash_table,
+                                    const char *key)
+{
+	size_t index = find_index(hash_table, key, hash_key(hash_table->hash, key));
+	assert(index != hash_table->capacity);
+	return hash_table->slots[index].value;
+}
+
+/* A probe sequence only ends at a group with an empty slot, so if the
+   removed entry's group already has one, no lookup ever probes past this
+   group and the slot can simply become empty.  Otherwise it is marked
+   deleted, and the next rehash clears it. */
+bool hash_table_swiss_remove(struct hash_table_swiss *hash_table,
+                             const char *key)
+{
+	size_t index = find_index(hash_table, key, hash_key(hash_table->hash, key));
+	if (index == hash_table->capacity) {
+		return false;
+	}
+	if (hash_table->own_keys) {
+		free((char *) hash_table->slots[index].key);
+	}
+	const int8_t *group = &hash_table->control[index / GROUP_SIZE * GROUP_SIZE];
+	if (match_byte(group, EMPTY) != 0) {
+		hash_table->control[index] = EMPTY;
+	}
+	else {
+		hash_table->control[index] = DELETED;
+		++hash_table->deleted;
+	}
+	hash_table->slots[index] = (struct slot) { 0 };
+	--hash_table->size;
+	return true;
+}
+
+size_t hash_table_swiss_buckets(struct hash_table_swiss *hash_table)
+{
+	return hash_table->capacity;
+}
+
+/* Every slot is a bucket of at most one entry */
+bool hash_table_swiss_next(struct hash_table_swiss *hash_table,
+                           struct hash_table_cursor *cursor,
+                           const char **key,
+                           uint32_t *value)
+{
+	size_t end = cursor->end < hash_table->capacity ? cursor->end : hash_table->capacity;
+	while (cursor->bucket < end) {
+		size_t index = cursor->bucket++;
+		if (hash_table->control[index] >= 0) {
+			*key = hash_table->slots[index].key;
+			*value = hash_table->slots[index].value;
+			return true;
+		}
+	}
+	return false;
+}
+
+void hash_table_swiss_destroy(struct hash_table_swiss *hash_table)
+{
+	for (size_t i = 0; hash_table->own_keys && i < hash_table->capacity; ++i) {
+		free((char *) hash_table->slots[i].key);
+	}
+	free(hash_table->slots);
+	free(hash_table->control);
+	free(hash_table);
+}
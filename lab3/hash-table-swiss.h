@@ -0,0 +1,35 @@
+#pragma once
+
+#include "hash-table-common.h"
+
+#include <stdbool.h>
+
+/* An open addressing table that checks 16 slots at a time, using one byte
+   of each slot's hash kept in a separate array.  Like hash_table_oa it is
+   not thread safe. */
+struct hash_table_swiss;
+struct hash_table_swiss *hash_table_swiss_create();
+void hash_table_swiss_add_entry(struct hash_table_swiss *hash_table,
+                                const char *key,
+                                uint32_t value);
+/* Same as calling add_entry for each of the N keys in turn */
+void hash_table_swiss_add_batch(struct hash_table_swiss *hash_table,
+                                const char **keys,
+                                const uint32_t *values,
+                                size_t n);
+bool hash_table_swiss_contains(struct hash_table_swiss *hash_table,
+                               const char *key);
+uint32_t hash_table_swiss_get_value(struct hash_table_swiss *hash_table,
+                                    const char* key);
+bool hash_table_swiss_remove(struct hash_table_swiss *hash_table,
+                             const char *key);
+void hash_table_swiss_destroy(struct hash_table_swiss *hash_table);
+/* Number of buckets, for iterating with struct hash_table_cursor */
+size_t hash_table_swiss_buckets(struct hash_table_swiss *hash_table);
+/* Return the next entry of CURSOR's buckets in KEY and VALUE, or false once
+   there are none left.  Entries added or removed during the iteration may
+   or may not be returned. */
+bool hash_table_swiss_next(struct hash_table_swiss *hash_table,
+                           struct hash_table_cursor *cursor,
+                           const char **key,
+                           uint32_t *value);
@@ -1,28 +1,266 @@
 #include "hash-table-base.h"
+#include "hash-table-cpu.h"
+#include "hash-table-image.h"
+#include "hash-table-lock.h"
+#include "hash-table-scan.h"
+#include "hash-table-oa.h"
+#include "hash-table-sharded.h"
+#include "hash-table-swiss.h"
 #include "hash-table-v1.h"
 #include "hash-table-v2.h"
+#include "hash-table-v3.h"
 
 #include <argp.h>
+#include <assert.h>
+#include <fcntl.h>
 #include <locale.h>
+#include <math.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/time.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 char *entries;
 
-void (*add_entry)(void *, const char *key, uint32_t value);
-
+/* Generated keys are one less than this long by default, and the mixed
+   workload's insert keys always are */
 #define BYTES_PER_STRING 8
 
+/* Key i is generated from a counter starting at KEY_SEED + (i << 32), so it
+   is the same whichever thread generates it */
+#define KEY_SEED 42
+
+/* One hash table implementation under test.  The tables all share the same
+   API, so the tester only ever calls them through these pointers. */
+struct hash_table_impl {
+	const char *name;
+	/* Whether add_entry may be called from several threads at once */
+	bool concurrent;
+	void *(*create)(void);
+	void (*add_entry)(void *hash_table, const char *key, uint32_t value);
+	void (*add_batch)(void *hash_table, const char **keys, const uint32_t *values,
+	                  size_t n);
+	bool (*contains)(void *hash_table, const char *key);
+	bool (*remove)(void *hash_table, const char *key);
+	size_t (*buckets)(void *hash_table);
+	hash_table_next_t next;
+	void (*destroy)(void *hash_table);
+	/* Number of sub-tables, for tables that have them */
+	uint32_t (*shards)(void *hash_table);
+	/* Whether the table's bucket locks follow hash_table_options.lock */
+	bool bucket_locks;
+	/* Consistent snapshots, for tables that have them */
+	void *(*snapshot_begin)(void *hash_table);
+	size_t (*snapshot_buckets)(void *snapshot);
+	hash_table_next_t snapshot_next;
+	void (*snapshot_end)(void *snapshot);
+#ifdef HASH_TABLE_INSTRUMENT
+	/* Adds up lock and bucket counters, for tables that keep them */
+	void (*instrument)(void *hash_table, struct instrument_report *report);
+#endif
+};
+
+#define HASH_TABLE_IMPL(version, is_concurrent, ...) {                           \
+	.name = #version,                                                        \
+	.concurrent = is_concurrent,                                             \
+	.create = (void *(*)(void)) hash_table_##version##_create,               \
+	.add_entry = (void (*)(void *, const char *, uint32_t))                  \
+		hash_table_##version##_add_entry,                                \
+	.add_batch = (void (*)(void *, const char **, const uint32_t *, size_t)) \
+		hash_table_##version##_add_batch,                                \
+	.contains = (bool (*)(void *, const char *)) hash_table_##version##_contains, \
+	.remove = (bool (*)(void *, const char *)) hash_table_##version##_remove, \
+	.buckets = (size_t (*)(void *)) hash_table_##version##_buckets,          \
+	.next = (hash_table_next_t) hash_table_##version##_next,                 \
+	.destroy = (void (*)(void *)) hash_table_##version##_destroy,            \
+	__VA_ARGS__                                                              \
+}
+
+#ifdef HASH_TABLE_INSTRUMENT
+#define INSTRUMENTED(version)                                                    \
+	.instrument = (void (*)(void *, struct instrument_report *))             \
+		hash_table_##version##_instrument,
+#else
+#define INSTRUMENTED(version)
+#endif
+
+#define SNAPSHOTS(version)                                                       \
+	.snapshot_begin = (void *(*)(void *)) hash_table_##version##_snapshot_begin, \
+	.snapshot_buckets = (size_t (*)(void *)) hash_table_##version##_snapshot_buckets, \
+	.snapshot_next = (hash_table_next_t) hash_table_##version##_snapshot_next, \
+	.snapshot_end = (void (*)(void *)) hash_table_##version##_snapshot_end,
+
+static const struct hash_table_impl impls[] = {
+	HASH_TABLE_IMPL(base, false),
+	HASH_TABLE_IMPL(v1, true, INSTRUMENTED(v1)),
+	HASH_TABLE_IMPL(v2, true, .bucket_locks = true, SNAPSHOTS(v2) INSTRUMENTED(v2)),
+	HASH_TABLE_IMPL(v3, true),
+	HASH_TABLE_IMPL(oa, false),
+	HASH_TABLE_IMPL(swiss, false),
+	HASH_TABLE_IMPL(sharded, true,
+	                .shards = (uint32_t (*)(void *)) hash_table_sharded_shards,
+	                .bucket_locks = true),
+};
+
+#define NUM_IMPLS (sizeof(impls) / sizeof(impls[0]))
+
+/* Most shard counts one run can compare */
+#define MAX_SHARD_COUNTS 16
+
+#define LOCK_KINDS 3
+
+/* Indexed by enum hash_table_lock_kind */
+static const char *lock_names[LOCK_KINDS] = { "mutex", "adaptive", "elided" };
+
 struct arguments {
 	uint32_t threads;
 	uint32_t size;
+	/* Which entries of impls to run, in order */
+	bool tables[NUM_IMPLS];
+	bool hash_report;
+	bool lookup_stats;
+	bool memory;
+	uint32_t readers;
+	/* Relative weights of reads, updates and inserts, all 0 if no mixed
+	   workload was asked for */
+	uint32_t mix[3];
+	uint32_t ops;
+	bool zipf;
+	double theta;
+	bool remove;
+	/* Threads to scan each table with at the end, 0 for no scan */
+	uint32_t scan;
+	bool snapshot;
+	/* Where to save each table's image, NULL for no image */
+	const char *image;
+	/* Shortest and longest generated keys, not counting the terminator */
+	uint32_t key_length[2];
+	/* File to read keys from instead of generating them, one per line */
+	const char *keys;
+	/* Untimed fills of each table before the timed ones */
+	uint32_t warmup;
+	/* Timed fills of each table, the last of which is checked */
+	uint32_t repeat;
+	/* Pin every worker thread to a CPU of its own */
+	bool pin;
+	/* Where to write fill timings for regression tracking, if anywhere */
+	const char *csv;
+	const char *json;
+	uint32_t batch;
+	/* Shard counts to run the sharded table with, 0 for one per CPU */
+	uint32_t shards[MAX_SHARD_COUNTS];
+	size_t shard_counts;
+	/* Bucket locks to run tables that have them with */
+	enum hash_table_lock_kind locks[LOCK_KINDS];
+	size_t lock_kinds;
+	/* Whether --lock was given, and so which lock a run used is printed */
+	bool lock_report;
+};
+
+enum {
+	OPT_TABLES = 0x100,
+	OPT_HASH,
+	OPT_HASH_REPORT,
+	OPT_LOOKUP_STATS,
+	OPT_ALLOCATOR,
+	OPT_OWN_KEYS,
+	OPT_MEMORY,
+	OPT_READERS,
+	OPT_MIX,
+	OPT_OPS,
+	OPT_DISTRIBUTION,
+	OPT_THETA,
+	OPT_REMOVE,
+	OPT_BATCH,
+	OPT_SHARDS,
+	OPT_LOCK,
+	OPT_SCAN,
+	OPT_SNAPSHOT,
+	OPT_IMAGE,
+	OPT_KEYS,
+	OPT_KEY_LENGTH,
+	OPT_WARMUP,
+	OPT_REPEAT,
+	OPT_PIN,
+	OPT_CSV,
+	OPT_JSON,
 };
 
 static struct argp_option options[] = { 
 	{ "threads", 't', "NUM", 0, "Number of threads."},
 	{ "size", 's', "NUM", 0, "Size per thread."},
+	{ "key-length", OPT_KEY_LENGTH, "MIN[:MAX]", 0,
+	  "Length of the generated keys, picked uniformly from MIN to MAX for "
+	  "each key. Default: 7."},
+	{ "keys", OPT_KEYS, "FILE", 0,
+	  "Use the first threads * size lines of FILE as the keys instead of "
+	  "generating them. Keys should be distinct, and inserts of the mixed "
+	  "workload may then update one of them instead of adding a key."},
+	{ "tables", OPT_TABLES, "LIST", 0,
+	  "Comma separated tables to run (base, v1, v2, v3, oa, swiss, sharded "
+	  "or all). Default: base,v1,v2."},
+	{ "hash", OPT_HASH, "NAME", 0,
+	  "Hash function the tables use (wy or bernstein). Default: wy."},
+	{ "hash-report", OPT_HASH_REPORT, 0, 0,
+	  "Report speed and bucket length distribution of every hash function."},
+	{ "lookup-stats", OPT_LOOKUP_STATS, 0, 0,
+	  "Report entries visited and keys compared per lookup."},
+	{ "allocator", OPT_ALLOCATOR, "NAME", 0,
+	  "Where list entries come from (arena or malloc). Default: arena."},
+	{ "own-keys", OPT_OWN_KEYS, 0, 0,
+	  "Have the tables copy keys, storing short ones in the entry itself."},
+	{ "memory", OPT_MEMORY, 0, 0,
+	  "Report insert throughput and resident memory of every table."},
+	{ "readers", OPT_READERS, "NUM", 0,
+	  "Threads looking keys up while thread safe tables are filled."},
+	{ "mix", OPT_MIX, "R:U:I", 0,
+	  "Run a mixed workload of reads, updates and inserts in this ratio "
+	  "after filling each table."},
+	{ "ops", OPT_OPS, "NUM", 0,
+	  "Operations per thread in the mixed workload. Default: the size."},
+	{ "distribution", OPT_DISTRIBUTION, "NAME", 0,
+	  "Which keys the mixed workload reads and updates (uniform or zipf). "
+	  "Default: uniform."},
+	{ "theta", OPT_THETA, "NUM", 0,
+	  "Skew of the zipf distribution, between 0 and 1. Default: 0.99."},
+	{ "remove", OPT_REMOVE, 0, 0,
+	  "Remove every other key from each table at the end, then check the "
+	  "right keys are left."},
+	{ "scan", OPT_SCAN, "NUM", 0,
+	  "Scan every entry of each table with this many threads at the end, "
+	  "at the same time as --remove if given."},
+	{ "snapshot", OPT_SNAPSHOT, 0, 0,
+	  "Scan a consistent snapshot, for tables that have them (v2)."},
+	{ "image", OPT_IMAGE, "FILE", 0,
+	  "Save each filled table as an image to FILE, then map it back and "
+	  "look every key up in it."},
+	{ "batch", OPT_BATCH, "NUM", 0,
+	  "Fill the tables with add_batch, this many keys per call."},
+	{ "shards", OPT_SHARDS, "LIST", 0,
+	  "Comma separated shard counts to run the sharded table with, 0 for "
+	  "one per CPU. Default: 0."},
+	{ "lock", OPT_LOCK, "LIST", 0,
+	  "Comma separated bucket locks to run v2 and the sharded table with "
+	  "(mutex, adaptive or elided). Default: mutex."},
+	{ "warmup", OPT_WARMUP, "NUM", 0,
+	  "Fill each table this many times without timing it first. Default: 0."},
+	{ "repeat", OPT_REPEAT, "NUM", 0,
+	  "Time filling each table this many times, report the median and add "
+	  "a line with the spread. Default: 1."},
+	{ "pin", OPT_PIN, 0, 0,
+	  "Pin every worker thread to a CPU of its own, round robin over the "
+	  "CPUs the process may use (Linux only)."},
+	{ "csv", OPT_CSV, "FILE", 0,
+	  "Write the fill timings of every table run to FILE as CSV."},
+	{ "json", OPT_JSON, "FILE", 0,
+	  "Write the fill timings of every table run to FILE as JSON."},
 	{ 0 } 
 };
 
@@ -64,6 +302,129 @@ static uint32_t parse_uint32_t(const char *string) {
 	return current;
 }
 
+static void parse_tables(const char *string, bool *tables)
+{
+	memset(tables, 0, NUM_IMPLS * sizeof(bool));
+	char *list = strdup(string);
+	char *saveptr = NULL;
+	for (char *name = strtok_r(list, ",", &saveptr);
+	     name != NULL;
+	     name = strtok_r(NULL, ",", &saveptr)) {
+		bool found = false;
+		for (size_t i = 0; i < NUM_IMPLS; ++i) {
+			if (strcmp(name, "all") == 0 || strcmp(name, impls[i].name) == 0) {
+				tables[i] = true;
+				found = true;
+			}
+		}
+		if (!found) {
+			fprintf(stderr, "unknown hash table: %s\n", name);
+			exit(EINVAL);
+		}
+	}
+	free(list);
+}
+
+static void parse_mix(const char *string, uint32_t *mix)
+{
+	char *list = strdup(string);
+	char *saveptr = NULL;
+	char *weight = strtok_r(list, ":", &saveptr);
+	for (size_t i = 0; i < 3; ++i) {
+		if (weight == NULL) {
+			fprintf(stderr, "mix needs three weights: %s\n", string);
+			exit(EINVAL);
+		}
+		mix[i] = parse_uint32_t(weight);
+		weight = strtok_r(NULL, ":", &saveptr);
+	}
+	if (weight != NULL || (uint64_t) mix[0] + mix[1] + mix[2] == 0
+	    || (uint64_t) mix[0] + mix[1] + mix[2] > UINT32_MAX) {
+		fprintf(stderr, "invalid mix: %s\n", string);
+		exit(EINVAL);
+	}
+	free(list);
+}
+
+static void parse_key_length(const char *string, uint32_t *key_length)
+{
+	char *list = strdup(string);
+	char *saveptr = NULL;
+	char *length = strtok_r(list, ":", &saveptr);
+	if (length == NULL) {
+		fprintf(stderr, "invalid key length: %s\n", string);
+		exit(EINVAL);
+	}
+	key_length[0] = parse_uint32_t(length);
+	key_length[1] = key_length[0];
+	length = strtok_r(NULL, ":", &saveptr);
+	if (length != NULL) {
+		key_length[1] = parse_uint32_t(length);
+	}
+	if (strtok_r(NULL, ":", &saveptr) != NULL
+	    || key_length[0] == 0 || key_length[0] > key_length[1]
+	    || key_length[1] == UINT32_MAX) {
+		fprintf(stderr, "invalid key length: %s\n", string);
+		exit(EINVAL);
+	}
+	free(list);
+}
+
+static void parse_shards(const char *string, struct arguments *arguments)
+{
+	char *list = strdup(string);
+	char *saveptr = NULL;
+	arguments->shard_counts = 0;
+	for (char *count = strtok_r(list, ",", &saveptr);
+	     count != NULL;
+	     count = strtok_r(NULL, ",", &saveptr)) {
+		if (arguments->shard_counts == MAX_SHARD_COUNTS) {
+			fprintf(stderr, "at most %d shard counts\n", MAX_SHARD_COUNTS);
+			exit(EINVAL);
+		}
+		arguments->shards[arguments->shard_counts++] = parse_uint32_t(count);
+	}
+	free(list);
+}
+
+static void parse_locks(const char *string, struct arguments *arguments)
+{
+	char *list = strdup(string);
+	char *saveptr = NULL;
+	arguments->lock_kinds = 0;
+	for (char *name = strtok_r(list, ",", &saveptr);
+	     name != NULL;
+	     name = strtok_r(NULL, ",", &saveptr)) {
+		size_t kind = 0;
+		while (kind < LOCK_KINDS && strcmp(name, lock_names[kind]) != 0) {
+			++kind;
+		}
+		if (kind == LOCK_KINDS || arguments->lock_kinds == LOCK_KINDS) {
+			fprintf(stderr, "invalid lock list: %s\n", string);
+			exit(EINVAL);
+		}
+		if (kind == HASH_TABLE_LOCK_ELIDED && !hash_table_lock_elision_supported()) {
+			fprintf(stderr, "no lock elision on this CPU, elided locks are adaptive\n");
+		}
+		arguments->locks[arguments->lock_kinds++] = kind;
+	}
+	arguments->lock_report = true;
+	free(list);
+}
+
+static hash_function_t parse_hash(const char *name)
+{
+	for (const struct hash_function *function = hash_functions;
+	     function->name != NULL;
+	     ++function) {
+		if (strcmp(name, function->name) == 0) {
+			return function->hash;
+		}
+	}
+	fprintf(stderr, "unknown hash function: %s\n", name);
+	exit(EINVAL);
+}
+
 static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 	struct arguments *arguments = state->input;
 	switch (key) {
@@ -73,12 +434,124 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 	case 's':
 		arguments->size = parse_uint32_t(arg);
 		break;
+	case OPT_TABLES:
+		parse_tables(arg, arguments->tables);
+		break;
+	case OPT_HASH:
+		hash_table_options.hash = parse_hash(arg);
+		break;
+	case OPT_HASH_REPORT:
+		arguments->hash_report = true;
+		break;
+	case OPT_LOOKUP_STATS:
+		arguments->lookup_stats = true;
+		hash_table_lookup_stats_enabled = true;
+		break;
+	case OPT_ALLOCATOR:
+		if (strcmp(arg, "arena") == 0) {
+			hash_table_options.arena = true;
+		}
+		else if (strcmp(arg, "malloc") == 0) {
+			hash_table_options.arena = false;
+		}
+		else {
+			fprintf(stderr, "unknown allocator: %s\n", arg);
+			exit(EINVAL);
+		}
+		break;
+	case OPT_OWN_KEYS:
+		hash_table_options.own_keys = true;
+		break;
+	case OPT_LOCK:
+		parse_locks(arg, arguments);
+		break;
+	case OPT_MEMORY:
+		arguments->memory = true;
+		break;
+	case OPT_READERS:
+		arguments->readers = parse_uint32_t(arg);
+		break;
+	case OPT_MIX:
+		parse_mix(arg, arguments->mix);
+		break;
+	case OPT_OPS:
+		arguments->ops = parse_uint32_t(arg);
+		break;
+	case OPT_DISTRIBUTION:
+		if (strcmp(arg, "uniform") == 0) {
+			arguments->zipf = false;
+		}
+		else if (strcmp(arg, "zipf") == 0) {
+			arguments->zipf = true;
+		}
+		else {
+			fprintf(stderr, "unknown distribution: %s\n", arg);
+			exit(EINVAL);
+		}
+		break;
+	case OPT_THETA: {
+		char *end = NULL;
+		arguments->theta = strtod(arg, &end);
+		if (*end != 0 || !(arguments->theta > 0 && arguments->theta < 1)) {
+			exit(EINVAL);
+		}
+		break;
+	}
+	case OPT_REMOVE:
+		arguments->remove = true;
+		break;
+	case OPT_SCAN:
+		arguments->scan = parse_uint32_t(arg);
+		break;
+	case OPT_SNAPSHOT:
+		arguments->snapshot = true;
+		break;
+	case OPT_IMAGE:
+		arguments->image = arg;
+		break;
+	case OPT_KEYS:
+		arguments->keys = arg;
+		break;
+	case OPT_KEY_LENGTH:
+		parse_key_length(arg, arguments->key_length);
+		break;
+	case OPT_WARMUP:
+		arguments->warmup = parse_uint32_t(arg);
+		break;
+	case OPT_REPEAT:
+		arguments->repeat = parse_uint32_t(arg);
+		if (arguments->repeat == 0) {
+			fprintf(stderr, "repeat needs at least one run\n");
+			exit(EINVAL);
+		}
+		break;
+	case OPT_PIN:
+		arguments->pin = true;
+		break;
+	case OPT_CSV:
+		arguments->csv = arg;
+		break;
+	case OPT_JSON:
+		arguments->json = arg;
+		break;
+	case OPT_BATCH:
+		arguments->batch = parse_uint32_t(arg);
+		break;
+	case OPT_SHARDS:
+		parse_shards(arg, arguments);
+		break;
 	}   
 	return 0;
 }
 
 static struct arguments arguments;
 static char *data;
+/* Bytes from one generated key to the next */
+static size_t key_stride;
+/* Where each key starts in data when they were read from --keys, which is
+   then the file mapped with a zero byte after it */
+static size_t *key_offsets;
+static size_t data_bytes;
 
 static size_t get_global_index(uint32_t thread, uint32_t index)
 {
@@ -87,139 +560,1014 @@ static size_t get_global_index(uint32_t thread, uint32_t index)
 
 static char *get_string(size_t global_index)
 {
-	return data + (global_index * BYTES_PER_STRING);
+	if (key_offsets != NULL) {
+		return data + key_offsets[global_index];
+	}
+	return data + (global_index * key_stride);
 }
 
-static unsigned long usec_diff(struct timeval *a, struct timeval *b)
+static unsigned long usec_diff(struct timespec *a, struct timespec *b)
 {
-	unsigned long usec;
-	usec = (b->tv_sec - a->tv_sec)*1000000;
-	usec += b->tv_usec - a->tv_usec;
-	return usec;
+	long nsec = (b->tv_sec - a->tv_sec) * 1000000000L + (b->tv_nsec - a->tv_nsec);
+	return nsec / 1000;
+}
+
+/* Longest chain length the hash report counts separately */
+#define HASH_REPORT_MAX_CHAIN 8
+
+/* Hash every key with FUNCTION, timing it, then bucket the hashes the way
+   the chained tables would once they hold every key.  The average length of
+   the chain a key ends up in is sum(length^2) / keys, which is 1 plus the
+   load factor for a perfectly uniform hash; the further above that, the
+   more a lookup has to walk. */
+static void report_hash(const struct hash_function *function)
+{
+	size_t keys = (size_t) arguments.threads * arguments.size;
+	size_t capacity = HASH_TABLE_CAPACITY;
+	while (keys > capacity * HASH_TABLE_MAX_LOAD) {
+		capacity *= 2;
+	}
+
+	uint32_t *hashes = calloc(keys, sizeof(uint32_t));
+	uint32_t *lengths = calloc(capacity, sizeof(uint32_t));
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < keys; ++i) {
+		hashes[i] = hash_key(function->hash, get_string(i));
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	unsigned long usec = usec_diff(&start, &end);
+
+	size_t histogram[HASH_REPORT_MAX_CHAIN + 1] = { 0 };
+	uint32_t longest = 0;
+	double chained = 0;
+	for (size_t i = 0; i < keys; ++i) {
+		++lengths[hashes[i] & (capacity - 1)];
+	}
+	for (size_t i = 0; i < capacity; ++i) {
+		uint32_t length = lengths[i];
+		++histogram[length < HASH_REPORT_MAX_CHAIN ? length : HASH_REPORT_MAX_CHAIN];
+		if (length > longest) {
+			longest = length;
+		}
+		chained += (double) length * length;
+	}
+
+	printf("Hash %s: %'lu usec (%.1f nsec/key)\n",
+	       function->name, usec, keys == 0 ? 0.0 : usec * 1000.0 / keys);
+	printf("  - %'zu buckets, longest chain %'u, average chain per key %.2f\n",
+	       capacity, longest, keys == 0 ? 0.0 : chained / keys);
+	printf("  - chain lengths:");
+	for (size_t i = 0; i <= HASH_REPORT_MAX_CHAIN; ++i) {
+		printf(" %zu%s: %'zu", i, i == HASH_REPORT_MAX_CHAIN ? "+" : "", histogram[i]);
+	}
+	printf("\n");
+
+	free(lengths);
+	free(hashes);
+}
+
+/* Resident set size of the process in KiB */
+static long resident_kib(void)
+{
+#ifdef __linux__
+	long size = 0;
+	long resident = 0;
+	FILE *statm = fopen("/proc/self/statm", "r");
+	if (statm == NULL) {
+		return 0;
+	}
+	if (fscanf(statm, "%ld %ld", &size, &resident) != 2) {
+		resident = 0;
+	}
+	fclose(statm);
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+#else
+	/* Only the peak is available, in bytes on macOS */
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss / 1024;
+#endif
 }
 
-static struct hash_table_v1 *hash_table_v1;
+static const struct hash_table_impl *impl;
+static void *hash_table;
 
-void *run_v1(void *arg) {
+void *run(void *arg) {
 	uint32_t thread = (uintptr_t) arg;
 	for (uint32_t j = 0; j < arguments.size; ++j) {
 		size_t global_index = get_global_index(thread, j);
 		char *string = get_string(global_index);
-		hash_table_v1_add_entry(hash_table_v1, string, global_index);
+		impl->add_entry(hash_table, string, global_index);
 	}
 	return NULL;
 }
 
-static struct hash_table_v2 *hash_table_v2;
-
-void *run_v2(void *arg) {
+/* Same as run, but adding --batch keys per call */
+void *run_batch(void *arg) {
 	uint32_t thread = (uintptr_t) arg;
-	for (uint32_t j = 0; j < arguments.size; ++j) {
-		size_t global_index = get_global_index(thread, j);
-		char *string = get_string(global_index);
-		hash_table_v2_add_entry(hash_table_v2, string, global_index);
+	const char **keys = calloc(arguments.batch, sizeof(char *));
+	uint32_t *values = calloc(arguments.batch, sizeof(uint32_t));
+	assert(keys != NULL && values != NULL);
+	for (uint32_t j = 0; j < arguments.size; j += arguments.batch) {
+		uint32_t count = arguments.size - j < arguments.batch ? arguments.size - j
+		                                                      : arguments.batch;
+		for (uint32_t k = 0; k < count; ++k) {
+			size_t global_index = get_global_index(thread, j + k);
+			keys[k] = get_string(global_index);
+			values[k] = global_index;
+		}
+		impl->add_batch(hash_table, keys, values, count);
 	}
+	free(values);
+	free(keys);
 	return NULL;
 }
 
-int main(int argc, char *argv[])
+/* Set once every writer has finished, which stops the readers */
+static atomic_bool writers_done;
+
+struct reader_result {
+	size_t lookups;
+	size_t found;
+};
+
+/* Look up every key over and over while the writers run.  Each reader
+   starts at a different key so they don't all hit the same buckets. */
+void *read_entries(void *arg) {
+	struct reader_result *result = arg;
+	size_t keys = (size_t) arguments.threads * arguments.size;
+	size_t global_index = keys == 0 ? 0 : (size_t) rand() % keys;
+	while (keys != 0 && !atomic_load_explicit(&writers_done, memory_order_relaxed)) {
+		if (impl->contains(hash_table, get_string(global_index))) {
+			++result->found;
+		}
+		++result->lookups;
+		if (++global_index == keys) {
+			global_index = 0;
+		}
+	}
+	return NULL;
+}
+
+enum op_type {
+	OP_READ,
+	OP_UPDATE,
+	OP_INSERT,
+	OP_TYPES,
+};
+
+static const char *op_names[OP_TYPES] = { "read", "update", "insert" };
+
+/* Latencies are bucketed by their highest set bit, then split into
+   LATENCY_SUB_BUCKETS linear steps, so every bucket is within about 6% of
+   the latencies it holds no matter how large they get. */
+#define LATENCY_SUB_BITS 4
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS (64 * LATENCY_SUB_BUCKETS)
+
+struct latency_histogram {
+	uint64_t count;
+	uint64_t buckets[LATENCY_BUCKETS];
+};
+
+static size_t latency_bucket(uint64_t nsec)
 {
-	arguments.threads = 4;
-	arguments.size = 25000;
-  
-	static struct argp argp = { options, parse_opt };
-	argp_parse(&argp, argc, argv, 0, 0, &arguments);
+	if (nsec < LATENCY_SUB_BUCKETS) {
+		return nsec;
+	}
+	unsigned shift = 63 - __builtin_clzll(nsec) - LATENCY_SUB_BITS;
+	return (shift + 1) * LATENCY_SUB_BUCKETS + ((nsec >> shift) & (LATENCY_SUB_BUCKETS - 1));
+}
 
-	setlocale(LC_ALL, "en_US.UTF-8");
+/* The middle of the latencies that land in BUCKET */
+static uint64_t latency_value(size_t bucket)
+{
+	if (bucket < LATENCY_SUB_BUCKETS) {
+		return bucket;
+	}
+	unsigned shift = bucket / LATENCY_SUB_BUCKETS - 1;
+	uint64_t low = (uint64_t) (LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS) << shift;
+	return low + ((UINT64_C(1) << shift) >> 1);
+}
 
-	data = calloc(arguments.threads * arguments.size, BYTES_PER_STRING);
+static uint64_t latency_percentile(const struct latency_histogram *histogram,
+                                   double percentile)
+{
+	uint64_t rank = ceil(histogram->count * percentile);
+	uint64_t seen = 0;
+	for (size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+		seen += histogram->buckets[i];
+		if (seen >= rank && seen != 0) {
+			return latency_value(i);
+		}
+	}
+	return 0;
+}
 
-	struct timeval start, end;
+static uint64_t nsec_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
 
-	gettimeofday(&start, NULL);
-	srand(42);
-	for (uint32_t i = 0; i < arguments.threads; ++i) {
-		for (uint32_t j = 0; j < arguments.size; ++j) {
-			size_t global_index = get_global_index(i, j);
-			char *string = get_string(global_index);
-			for (uint32_t k = 0; k < (BYTES_PER_STRING - 1); ++k) {
-				int r = rand() % 52;
-				if (r < 26) {
-					string[k] = r + 0x41;
-				}
-				else {
-					string[k] = r + 0x47;
-				}
+/* splitmix64, so every thread gets its own cheap, reproducible stream */
+static uint64_t next_random(uint64_t *state)
+{
+	uint64_t z = (*state += UINT64_C(0x9e3779b97f4a7c15));
+	z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+	z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+	return z ^ (z >> 31);
+}
+
+/* Picks which of the keys added by the insert phase an operation uses.  The
+   zipf distribution follows Gray et al., "Quickly Generating Billion-Record
+   Synthetic Databases" (as YCSB does): rank r is picked with probability
+   proportional to 1 / r^theta, which needs zeta(keys, theta) once up front
+   but only one pow per key afterwards. */
+struct key_distribution {
+	size_t keys;
+	bool zipf;
+	double theta;
+	double alpha;
+	double zetan;
+	double eta;
+};
+
+static struct key_distribution key_distribution;
+
+static double zeta(size_t n, double theta)
+{
+	double sum = 0;
+	for (size_t i = 1; i <= n; ++i) {
+		sum += 1 / pow(i, theta);
+	}
+	return sum;
+}
+
+static void init_key_distribution(size_t keys, bool zipf, double theta)
+{
+	key_distribution.keys = keys;
+	key_distribution.zipf = zipf;
+	if (!zipf || keys < 2) {
+		return;
+	}
+	double zeta2 = zeta(2, theta);
+	key_distribution.theta = theta;
+	key_distribution.alpha = 1 / (1 - theta);
+	key_distribution.zetan = zeta(keys, theta);
+	key_distribution.eta = (1 - pow(2.0 / keys, 1 - theta))
+	                       / (1 - zeta2 / key_distribution.zetan);
+}
+
+static size_t next_key(uint64_t *random_state)
+{
+	const struct key_distribution *distribution = &key_distribution;
+	uint64_t random = next_random(random_state);
+	if (!distribution->zipf || distribution->keys < 2) {
+		return random % distribution->keys;
+	}
+
+	double u = (random >> 11) * 0x1.0p-53;
+	double uz = u * distribution->zetan;
+	size_t rank;
+	if (uz < 1) {
+		rank = 0;
+	}
+	else if (uz < 1 + pow(0.5, distribution->theta)) {
+		rank = 1;
+	}
+	else {
+		rank = distribution->keys * pow(distribution->eta * u - distribution->eta + 1,
+		                                distribution->alpha);
+		if (rank >= distribution->keys) {
+			rank = distribution->keys - 1;
+		}
+	}
+	/* Spread the popular ranks over the table instead of the first keys
+	   generated; the multiplier is prime, so this is a permutation */
+	return (rank * UINT64_C(2654435761)) % distribution->keys;
+}
+
+/* New keys for the insert operations.  They only use the characters 0-?,
+   which never appear in the generated keys, so every insert adds a key. */
+static char *insert_data;
+
+static char *get_insert_string(size_t index)
+{
+	char *string = insert_data + (index * BYTES_PER_STRING);
+	for (uint32_t k = 0; k < (BYTES_PER_STRING - 1); ++k) {
+		string[k] = 0x30 + ((index >> (4 * k)) & 0xf);
+	}
+	string[BYTES_PER_STRING - 1] = 0;
+	return string;
+}
+
+struct workload_thread {
+	uint32_t thread;
+	/* Readers only look keys up, until every other thread is done */
+	bool reader;
+	struct latency_histogram latency[OP_TYPES];
+};
+
+void *run_workload_thread(void *arg) {
+	struct workload_thread *worker = arg;
+	uint64_t random_state = worker->thread;
+	uint32_t total = arguments.mix[0] + arguments.mix[1] + arguments.mix[2];
+	size_t inserts = (size_t) worker->thread * arguments.ops;
+
+	for (uint32_t i = 0;
+	     worker->reader ? !atomic_load_explicit(&writers_done, memory_order_relaxed)
+	                    : i < arguments.ops;
+	     ++i) {
+		enum op_type op = OP_READ;
+		if (!worker->reader) {
+			uint32_t pick = next_random(&random_state) % total;
+			if (pick >= arguments.mix[0] + arguments.mix[1]) {
+				op = OP_INSERT;
 			}
-			string[BYTES_PER_STRING - 1] = 0;
+			else if (pick >= arguments.mix[0]) {
+				op = OP_UPDATE;
+			}
+		}
+		char *string = op == OP_INSERT ? get_insert_string(inserts++)
+		                               : get_string(next_key(&random_state));
+
+		uint64_t start = nsec_now();
+		switch (op) {
+		case OP_READ:
+			impl->contains(hash_table, string);
+			break;
+		case OP_UPDATE:
+		case OP_INSERT:
+			impl->add_entry(hash_table, string, i);
+			break;
+		default:
+			break;
 		}
+		uint64_t nsec = nsec_now() - start;
+
+		struct latency_histogram *latency = &worker->latency[op];
+		++latency->count;
+		++latency->buckets[latency_bucket(nsec)];
 	}
-	gettimeofday(&end, NULL);
-	printf("Generation: %'lu usec\n", usec_diff(&start, &end));
+	return NULL;
+}
 
-	struct hash_table_base *hash_table_base = hash_table_base_create();
-	gettimeofday(&start, NULL);
-	for (uint32_t i = 0; i < arguments.threads; ++i) {
-		for (uint32_t j = 0; j < arguments.size; ++j) {
-			size_t global_index = get_global_index(i, j);
-			char *string = get_string(global_index);
-			hash_table_base_add_entry(hash_table_base, string, global_index);
+/* Threads started by run_timed wait here until all of them exist, so they
+   start together however long creating them took */
+static atomic_uint gate_arrived;
+static atomic_bool gate_open;
+
+struct timed_thread {
+	void *(*function)(void *);
+	void *arg;
+	/* When function returned */
+	uint64_t finish;
+};
+
+static void *run_timed_thread(void *arg)
+{
+	struct timed_thread *timed = arg;
+	atomic_fetch_add(&gate_arrived, 1);
+	while (!atomic_load_explicit(&gate_open, memory_order_acquire)) {
+		sched_yield();
+	}
+	timed->function(timed->arg);
+	timed->finish = nsec_now();
+	return NULL;
+}
+
+/* Run each of the COUNT entries of TIMED on a thread of its own (the Ith
+   on the Ith CPU with --pin), all starting at once.  Once the first
+   WRITERS have returned, writers_done tells the others to stop.  NSEC is
+   set to the time from the start until the last of the writers returned,
+   so neither creating nor joining threads is counted. */
+static int run_timed(pthread_t *threads,
+                     struct timed_thread *timed,
+                     uint32_t count,
+                     uint32_t writers,
+                     uint64_t *nsec)
+{
+	atomic_store(&writers_done, false);
+	atomic_store(&gate_arrived, 0);
+	atomic_store(&gate_open, false);
+	for (uint32_t i = 0; i < count; ++i) {
+		pthread_attr_t attr;
+		int err = pthread_attr_init(&attr);
+		if (err == 0) {
+			if (arguments.pin) {
+				pin_to_cpu(&attr, i);
+			}
+			err = pthread_create(&threads[i], &attr, run_timed_thread, &timed[i]);
+			pthread_attr_destroy(&attr);
+		}
+		if (err != 0) {
+			printf("pthread_create returned %d\n", err);
+			return err;
+		}
+	}
+	while (atomic_load(&gate_arrived) < count) {
+		sched_yield();
+	}
+	uint64_t start = nsec_now();
+	atomic_store_explicit(&gate_open, true, memory_order_release);
+
+	uint64_t finish = start;
+	for (uint32_t i = 0; i < count; ++i) {
+		if (i == writers) {
+			atomic_store(&writers_done, true);
+		}
+		int err = pthread_join(threads[i], NULL);
+		if (err != 0) {
+			printf("pthread_join returned %d\n", err);
+			return err;
+		}
+		if (i < writers && timed[i].finish > finish) {
+			finish = timed[i].finish;
+		}
+	}
+	*nsec = finish - start;
+	return 0;
+}
+
+/* Run the --mix workload against the already filled table, then report
+   the throughput and the latency percentiles of each kind of operation.
+   Each of the threads does --ops operations, and --readers extra threads
+   only look keys up while they run. */
+static int run_workload(pthread_t *threads)
+{
+	uint32_t readers = impl->concurrent ? arguments.readers : 0;
+	uint32_t workers = arguments.threads + readers;
+	struct workload_thread *workload_threads = calloc(workers, sizeof(struct workload_thread));
+	insert_data = calloc((size_t) arguments.threads * arguments.ops, BYTES_PER_STRING);
+	assert(workload_threads != NULL && insert_data != NULL);
+	for (uint32_t i = 0; i < workers; ++i) {
+		workload_threads[i].thread = i;
+		workload_threads[i].reader = i >= arguments.threads;
+	}
+
+	uint64_t nsec = 0;
+	if (!impl->concurrent) {
+		uint64_t start = nsec_now();
+		for (uint32_t i = 0; i < arguments.threads; ++i) {
+			run_workload_thread(&workload_threads[i]);
 		}
+		nsec = nsec_now() - start;
+	}
+	else {
+		struct timed_thread *timed = calloc(workers, sizeof(struct timed_thread));
+		assert(timed != NULL);
+		for (uint32_t i = 0; i < workers; ++i) {
+			timed[i] = (struct timed_thread) { run_workload_thread, &workload_threads[i] };
+		}
+		int err = run_timed(threads, timed, workers, arguments.threads, &nsec);
+		free(timed);
+		if (err != 0) {
+			return err;
+		}
+	}
+
+	struct latency_histogram *latency = calloc(OP_TYPES, sizeof(struct latency_histogram));
+	assert(latency != NULL);
+	uint64_t ops = 0;
+	for (uint32_t i = 0; i < workers; ++i) {
+		for (size_t op = 0; op < OP_TYPES; ++op) {
+			latency[op].count += workload_threads[i].latency[op].count;
+			for (size_t j = 0; j < LATENCY_BUCKETS; ++j) {
+				latency[op].buckets[j] += workload_threads[i].latency[op].buckets[j];
+			}
+		}
+	}
+	for (size_t op = 0; op < OP_TYPES; ++op) {
+		ops += latency[op].count;
+	}
+
+	printf("  - %u:%u:%u mix, %s keys: %'.0f ops/sec\n",
+	       arguments.mix[0], arguments.mix[1], arguments.mix[2],
+	       arguments.zipf ? "zipf" : "uniform",
+	       nsec == 0 ? 0.0 : ops * 1e9 / nsec);
+	for (size_t op = 0; op < OP_TYPES; ++op) {
+		if (latency[op].count == 0) {
+			continue;
+		}
+		printf("  - %s: %'lu ops, p50 %'lu nsec, p99 %'lu nsec, p999 %'lu nsec\n",
+		       op_names[op], latency[op].count,
+		       latency_percentile(&latency[op], 0.5),
+		       latency_percentile(&latency[op], 0.99),
+		       latency_percentile(&latency[op], 0.999));
+	}
+
+	free(latency);
+	free(workload_threads);
+	/* The table still points at these keys, so they go once it is destroyed */
+	return 0;
+}
+
+/* Run WRITER once per thread, with READERS threads looking keys up until
+   they are all done, and set NSEC to how long the writers took.  Tables
+   that are not thread safe get no readers, and the writers are run one
+   after the other from the calling thread. */
+static int run_threads(void *(*writer)(void *),
+                       pthread_t *threads,
+                       uint32_t readers,
+                       struct reader_result *reader_results,
+                       uint64_t *nsec)
+{
+	if (!impl->concurrent) {
+		uint64_t start = nsec_now();
+		for (uintptr_t i = 0; i < arguments.threads; ++i) {
+			writer((void *) i);
+		}
+		*nsec = nsec_now() - start;
+		return 0;
+	}
+
+	/* Writers first, then the readers */
+	uint32_t count = arguments.threads + readers;
+	struct timed_thread *timed = calloc(count, sizeof(struct timed_thread));
+	assert(timed != NULL);
+	for (uintptr_t i = 0; i < arguments.threads; ++i) {
+		timed[i] = (struct timed_thread) { writer, (void *) i };
+	}
+	for (uint32_t i = 0; i < readers; ++i) {
+		timed[arguments.threads + i] = (struct timed_thread) { read_entries, &reader_results[i] };
+	}
+	int err = run_timed(threads, timed, count, arguments.threads, nsec);
+	free(timed);
+	return err;
+}
+
+static void print_readers(uint32_t readers, struct reader_result *reader_results)
+{
+	if (readers == 0) {
+		return;
 	}
-	gettimeofday(&end, NULL);
-	printf("Hash table base: %'lu usec\n", usec_diff(&start, &end));
+	struct reader_result total = { 0 };
+	for (uint32_t i = 0; i < readers; ++i) {
+		total.lookups += reader_results[i].lookups;
+		total.found += reader_results[i].found;
+	}
+	printf("  - %'zu lookups by %u readers (%'zu found)\n",
+	       total.lookups, readers, total.found);
+}
 
+static _Atomic size_t removed;
+
+/* Remove every other key this thread added */
+void *remove_entries(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	size_t count = 0;
+	for (uint32_t j = 1; j < arguments.size; j += 2) {
+		char *string = get_string(get_global_index(thread, j));
+		count += impl->remove(hash_table, string);
+	}
+	atomic_fetch_add(&removed, count);
+	return NULL;
+}
+
+/* Time removing every other key from the table, with the readers running,
+   then check exactly those keys are gone */
+static int run_remove(pthread_t *threads, uint32_t readers)
+{
+	struct reader_result *reader_results = calloc(readers, sizeof(struct reader_result));
+	uint64_t nsec = 0;
+
+	atomic_store(&removed, 0);
+	int err = run_threads(remove_entries, threads, readers, reader_results, &nsec);
+	if (err != 0) {
+		return err;
+	}
+
+	size_t left = 0;
 	size_t missing = 0;
 	for (uint32_t i = 0; i < arguments.threads; ++i) {
 		for (uint32_t j = 0; j < arguments.size; ++j) {
-			size_t global_index = get_global_index(i, j);
-			char *string = get_string(global_index);
-			if (!hash_table_base_contains(hash_table_base, string)) {
+			char *string = get_string(get_global_index(i, j));
+			bool contains = impl->contains(hash_table, string);
+			if (j % 2 == 1 && contains) {
+				++left;
+			}
+			else if (j % 2 == 0 && !contains) {
 				++missing;
 			}
 		}
 	}
-	printf("  - %'lu missing\n", missing);
-	hash_table_base_destroy(hash_table_base);
+	printf("  - %'zu removed in %'lu usec, %'zu left behind, %'zu missing\n",
+	       atomic_load(&removed), (unsigned long) (nsec / 1000), left, missing);
+	print_readers(readers, reader_results);
+	free(reader_results);
+	return 0;
+}
 
-	pthread_t *threads = calloc(arguments.threads, sizeof(pthread_t));
+static _Atomic size_t scanned_bytes;
 
-	hash_table_v1 = hash_table_v1_create();
-	gettimeofday(&start, NULL);
-	for (uintptr_t i = 0; i < arguments.threads; ++i) {
-		int err = pthread_create(&threads[i], NULL, run_v1, (void*) i);
+/* Read the key, like an export would */
+static void visit_entry(void *context, const char *key, uint32_t value)
+{
+	(void) context;
+	(void) value;
+	atomic_fetch_add_explicit(&scanned_bytes, strlen(key), memory_order_relaxed);
+}
+
+struct scan {
+	void *hash_table;
+	hash_table_next_t next;
+	size_t buckets;
+	size_t visited;
+	unsigned long usec;
+};
+
+static void *run_scan(void *arg)
+{
+	struct scan *scan = arg;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	scan->visited = hash_table_scan(scan->hash_table, scan->next, scan->buckets,
+	                                arguments.scan, visit_entry, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	scan->usec = usec_diff(&start, &end);
+	return NULL;
+}
+
+/* Scan the whole table from a thread of its own, while removing every
+   other key if asked to.  A snapshot sees the table as it was before.
+   Tables that are not thread safe are scanned after the removal. */
+static int run_scan_and_remove(pthread_t *threads, uint32_t readers)
+{
+	if (!impl->concurrent && arguments.remove) {
+		int err = run_remove(threads, readers);
 		if (err != 0) {
-			printf("pthread_create returned %d\n", err);
 			return err;
 		}
 	}
-	for (uintptr_t i = 0; i < arguments.threads; ++i) {
-		int err = pthread_join(threads[i], NULL);
+
+	bool snapshot = arguments.snapshot && impl->snapshot_begin != NULL;
+	struct scan scan = { hash_table, impl->next, 0, 0, 0 };
+	if (snapshot) {
+		scan.hash_table = impl->snapshot_begin(hash_table);
+		scan.next = impl->snapshot_next;
+		scan.buckets = impl->snapshot_buckets(scan.hash_table);
+	}
+	else {
+		scan.buckets = impl->buckets(hash_table);
+	}
+	atomic_store(&scanned_bytes, 0);
+
+	pthread_t scanner;
+	int err = pthread_create(&scanner, NULL, run_scan, &scan);
+	if (err != 0) {
+		return err;
+	}
+	if (impl->concurrent && arguments.remove) {
+		err = run_remove(threads, readers);
+		if (err != 0) {
+			return err;
+		}
+	}
+	err = pthread_join(scanner, NULL);
+	if (err != 0) {
+		return err;
+	}
+	if (snapshot) {
+		impl->snapshot_end(scan.hash_table);
+	}
+	printf("  - %'zu entries (%'zu key bytes) scanned by %'u thread%s in %'lu usec%s\n",
+	       scan.visited, atomic_load(&scanned_bytes), arguments.scan,
+	       arguments.scan == 1 ? "" : "s", scan.usec, snapshot ? " from a snapshot" : "");
+	return 0;
+}
+
+#ifdef HASH_TABLE_INSTRUMENT
+/* Everything the table's counters saw, from the first insert up to now */
+static void print_instrument(void)
+{
+	if (impl->instrument == NULL) {
+		return;
+	}
+	struct instrument_report report = { 0 };
+	impl->instrument(hash_table, &report);
+
+	for (size_t i = 0; i < report.lock_count; ++i) {
+		uint64_t acquisitions = report.locks[i].acquisitions;
+		uint64_t contended = report.locks[i].contended;
+		printf("  - %s: %'lu acquisitions, %'lu contended (%.2f%%), %'lu usec waiting\n",
+		       report.locks[i].name, acquisitions, contended,
+		       acquisitions == 0 ? 0.0 : 100.0 * contended / acquisitions,
+		       report.locks[i].wait_nsec / 1000);
+	}
+
+	printf("  - chain lengths:");
+	const char *separator = " ";
+	for (size_t i = 0; i < INSTRUMENT_CHAIN_LENGTHS; ++i) {
+		if (report.chain_lengths[i] != 0) {
+			printf("%s%zu%s: %'zu", separator, i,
+			       i == INSTRUMENT_CHAIN_LENGTHS - 1 ? "+" : "", report.chain_lengths[i]);
+			separator = ", ";
+		}
+	}
+	printf("\n");
+
+	printf("  - hot buckets (%.1f hits on average):",
+	       report.buckets == 0 ? 0.0 : (double) report.hits / report.buckets);
+	for (size_t i = 0; i < INSTRUMENT_HOT_BUCKETS && report.hot[i].hits != 0; ++i) {
+		printf("%s%zu (%'lu hits, %zu long)", i == 0 ? " " : ", ", report.hot[i].index,
+		       report.hot[i].hits, report.hot[i].length);
+	}
+	printf("\n");
+}
+#endif
+
+/* Save the table to an image, map it back and check every key is in it */
+static int run_image(void)
+{
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int err = hash_table_image_save(arguments.image, hash_table, impl->next,
+	                                impl->buckets(hash_table));
+	if (err != 0) {
+		fprintf(stderr, "cannot save %s: %s\n", arguments.image, strerror(err));
+		return err;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	unsigned long save_usec = usec_diff(&start, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	struct hash_table_image *image = hash_table_image_open(arguments.image);
+	if (image == NULL) {
+		err = errno;
+		fprintf(stderr, "cannot open %s: %s\n", arguments.image, strerror(err));
+		return err;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	unsigned long open_usec = usec_diff(&start, &end);
+
+	size_t missing = 0;
+	for (uint32_t i = 0; i < arguments.threads; ++i) {
+		for (uint32_t j = 0; j < arguments.size; ++j) {
+			char *string = get_string(get_global_index(i, j));
+			if (!hash_table_image_contains(image, string)) {
+				++missing;
+			}
+		}
+	}
+	printf("  - %'zu byte image saved in %'lu usec, opened in %'lu usec, %'zu missing\n",
+	       hash_table_image_bytes(image), save_usec, open_usec, missing);
+	hash_table_image_close(image);
+	return 0;
+}
+
+/* Spread of the timed fills of a table */
+struct timing {
+	uint32_t runs;
+	uint64_t min;
+	uint64_t median;
+	uint64_t max;
+	double mean;
+	/* Sample standard deviation, 0 for a single run */
+	double stddev;
+};
+
+static int compare_uint64_t(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a;
+	uint64_t y = *(const uint64_t *) b;
+	return (x > y) - (x < y);
+}
+
+static struct timing get_timing(const uint64_t *samples, uint32_t runs)
+{
+	uint64_t *sorted = malloc(runs * sizeof(uint64_t));
+	assert(sorted != NULL);
+	memcpy(sorted, samples, runs * sizeof(uint64_t));
+	qsort(sorted, runs, sizeof(uint64_t), compare_uint64_t);
+
+	struct timing timing = { .runs = runs, .min = sorted[0], .max = sorted[runs - 1] };
+	timing.median = runs % 2 == 1 ? sorted[runs / 2]
+	                               : (sorted[runs / 2 - 1] + sorted[runs / 2]) / 2;
+	for (uint32_t i = 0; i < runs; ++i) {
+		timing.mean += (double) sorted[i] / runs;
+	}
+	for (uint32_t i = 0; runs > 1 && i < runs; ++i) {
+		double deviation = sorted[i] - timing.mean;
+		timing.stddev += deviation * deviation / (runs - 1);
+	}
+	timing.stddev = sqrt(timing.stddev);
+	free(sorted);
+	return timing;
+}
+
+static FILE *csv;
+static FILE *json;
+/* Whether a run has been written to json yet, to put commas between them */
+static bool json_started;
+
+static const char *hash_name(hash_function_t hash)
+{
+	for (const struct hash_function *function = hash_functions;
+	     function->name != NULL;
+	     ++function) {
+		if (function->hash == hash) {
+			return function->name;
+		}
+	}
+	return "unknown";
+}
+
+/* Write the fill timings of the current table to --csv and --json, in
+   nsec.  JSON runs also have every timed run's sample. */
+static void write_results(const struct timing *timing,
+                          const uint64_t *samples,
+                          uint32_t shards,
+                          size_t missing)
+{
+	const char *lock = impl->bucket_locks ? lock_names[hash_table_options.lock] : "";
+	uint32_t readers = impl->concurrent ? arguments.readers : 0;
+	if (csv != NULL) {
+		fprintf(csv, "%s,%s,%s,%u,%u,%u,%u,%u,%u,%u,%lu,%lu,%.0f,%.0f,%lu,%zu\n",
+		        impl->name, hash_name(hash_table_options.hash), lock, shards,
+		        arguments.threads, arguments.size, readers, arguments.batch,
+		        arguments.warmup, timing->runs, timing->min, timing->median,
+		        timing->mean, timing->stddev, timing->max, missing);
+	}
+	if (json != NULL) {
+		fprintf(json, "%s\n  {\"table\": \"%s\", \"hash\": \"%s\", \"lock\": \"%s\", "
+		        "\"shards\": %u, \"threads\": %u, \"size\": %u, \"readers\": %u, "
+		        "\"batch\": %u, \"warmup\": %u, \"runs\": %u, \"min_nsec\": %lu, "
+		        "\"median_nsec\": %lu, \"mean_nsec\": %.0f, \"stddev_nsec\": %.0f, "
+		        "\"max_nsec\": %lu, \"missing\": %zu, \"samples_nsec\": [",
+		        json_started ? "," : "", impl->name, hash_name(hash_table_options.hash),
+		        lock, shards, arguments.threads, arguments.size, readers,
+		        arguments.batch, arguments.warmup, timing->runs, timing->min,
+		        timing->median, timing->mean, timing->stddev, timing->max, missing);
+		for (uint32_t i = 0; i < timing->runs; ++i) {
+			fprintf(json, "%s%lu", i == 0 ? "" : ", ", samples[i]);
+		}
+		fprintf(json, "]}");
+		json_started = true;
+	}
+}
+
+/* Time inserting every key into IMPL, then check none of them went missing.
+   Tables that are not thread safe are filled from the calling thread. */
+static int run_table(const struct hash_table_impl *table_impl, pthread_t *threads)
+{
+	uint32_t readers = table_impl->concurrent ? arguments.readers : 0;
+	struct reader_result *reader_results = calloc(readers, sizeof(struct reader_result));
+	uint64_t *samples = calloc(arguments.repeat, sizeof(uint64_t));
+	assert(samples != NULL);
+
+	impl = table_impl;
+	long resident_before = 0;
+	int err = 0;
+	for (uint32_t iteration = 0; iteration < arguments.warmup + arguments.repeat; ++iteration) {
+		/* Only the last run's table is kept for the checks below */
+		if (iteration > 0) {
+			impl->destroy(hash_table);
+		}
+		memset(reader_results, 0, readers * sizeof(struct reader_result));
+		resident_before = resident_kib();
+		hash_table = impl->create();
+		uint64_t nsec = 0;
+		err = run_threads(arguments.batch > 0 ? run_batch : run, threads, readers,
+		                  reader_results, &nsec);
 		if (err != 0) {
-			printf("pthread_join returned %d\n", err);
 			return err;
 		}
+		if (iteration >= arguments.warmup) {
+			samples[iteration - arguments.warmup] = nsec;
+		}
 	}
-	gettimeofday(&end, NULL);
-	printf("Hash table v1: %'lu usec\n", usec_diff(&start, &end));
+	struct timing timing = get_timing(samples, arguments.repeat);
+	unsigned long usec = timing.median / 1000;
+	long resident_after = resident_kib();
+	printf("Hash table %s: %'lu usec\n", impl->name, usec);
 
-	missing = 0;
+	size_t missing = 0;
+	memset(&hash_table_lookup_stats, 0, sizeof(hash_table_lookup_stats));
 	for (uint32_t i = 0; i < arguments.threads; ++i) {
 		for (uint32_t j = 0; j < arguments.size; ++j) {
 			size_t global_index = get_global_index(i, j);
 			char *string = get_string(global_index);
-			if (!hash_table_v1_contains(hash_table_v1, string)) {
+			if (!impl->contains(hash_table, string)) {
 				++missing;
 			}
 		}
 	}
 	printf("  - %'lu missing\n", missing);
-	hash_table_v1_destroy(hash_table_v1);
+	uint32_t shards = 0;
+	if (impl->shards != NULL) {
+		shards = impl->shards(hash_table);
+		printf("  - %'u shard%s\n", shards, shards == 1 ? "" : "s");
+	}
+	if (arguments.lock_report && impl->bucket_locks) {
+		printf("  - %s bucket locks\n", lock_names[hash_table_options.lock]);
+	}
+	if (arguments.repeat > 1) {
+		printf("  - %'u runs: min %'lu, median %'lu, mean %'.0f, max %'lu, stddev %'.0f usec\n",
+		       timing.runs, timing.min / 1000, timing.median / 1000, timing.mean / 1000,
+		       timing.max / 1000, timing.stddev / 1000);
+	}
+	write_results(&timing, samples, shards, missing);
+	free(samples);
+	print_readers(readers, reader_results);
+	free(reader_results);
+	/* Every entry visited used to cost a strcmp, now only the key compares do */
+	if (arguments.lookup_stats) {
+		struct hash_table_lookup_stats stats = hash_table_lookup_stats;
+		double lookups = stats.lookups == 0 ? 1 : stats.lookups;
+		printf("  - %.2f entries visited, %.3f keys compared per lookup\n",
+		       stats.nodes / lookups, stats.key_compares / lookups);
+	}
+	if (arguments.memory) {
+		double inserts = (double) arguments.threads * arguments.size;
+		printf("  - %'.0f inserts/sec, %'ld KiB resident (%+'ld KiB)\n",
+		       usec == 0 ? 0.0 : inserts * 1000000 / usec,
+		       resident_after, resident_after - resident_before);
+	}
+	if (arguments.image != NULL) {
+		err = run_image();
+		if (err != 0) {
+			return err;
+		}
+	}
+	/* Reads and updates need keys from the insert phase to pick from */
+	if (arguments.mix[0] + arguments.mix[1] + arguments.mix[2] != 0
+	    && key_distribution.keys != 0) {
+		err = run_workload(threads);
+		if (err != 0) {
+			return err;
+		}
+	}
+	if (arguments.scan > 0) {
+		err = run_scan_and_remove(threads, readers);
+		if (err != 0) {
+			return err;
+		}
+	}
+	else if (arguments.remove) {
+		err = run_remove(threads, readers);
+		if (err != 0) {
+			return err;
+		}
+	}
+#ifdef HASH_TABLE_INSTRUMENT
+	print_instrument();
+#endif
+	impl->destroy(hash_table);
+	free(insert_data);
+	insert_data = NULL;
+	return 0;
+}
+
+/* Write key GLOBAL_INDEX into its place in data, as letters drawn from
+   its own counter based stream */
+static void generate_key(size_t global_index)
+{
+	char *string = get_string(global_index);
+	uint64_t state = KEY_SEED + ((uint64_t) global_index << 32);
+	uint32_t length = arguments.key_length[0];
+	if (arguments.key_length[1] > length) {
+		length += next_random(&state) % (arguments.key_length[1] - length + 1);
+	}
+	/* 52^11 < 2^64, so each random number is good for 11 letters */
+	uint64_t random = 0;
+	for (uint32_t k = 0; k < length; ++k) {
+		if (k % 11 == 0) {
+			random = next_random(&state);
+		}
+		int r = random % 52;
+		random /= 52;
+		if (r < 26) {
+			string[k] = r + 0x41;
+		}
+		else {
+			string[k] = r + 0x47;
+		}
+	}
+	string[length] = 0;
+}
+
+/* Each thread generates the keys its writer will add, so they are also
+   first touched by the thread that uses them */
+static void *generate_keys(void *arg)
+{
+	uint32_t thread = (uintptr_t) arg;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		generate_key(get_global_index(thread, j));
+	}
+	return NULL;
+}
 
-	hash_table_v2 = hash_table_v2_create();
-	gettimeofday(&start, NULL);
+static int run_generate_keys(pthread_t *threads)
+{
+	key_stride = (size_t) arguments.key_length[1] + 1;
+	data = calloc((size_t) arguments.threads * arguments.size, key_stride);
+	assert(data != NULL);
 	for (uintptr_t i = 0; i < arguments.threads; ++i) {
-		int err = pthread_create(&threads[i], NULL, run_v2, (void*) i);
+		int err = pthread_create(&threads[i], NULL, generate_keys, (void *) i);
 		if (err != 0) {
 			printf("pthread_create returned %d\n", err);
 			return err;
@@ -232,24 +1580,169 @@ int main(int argc, char *argv[])
 			return err;
 		}
 	}
-	gettimeofday(&end, NULL);
-	printf("Hash table v2: %'lu usec\n", usec_diff(&start, &end));
+	return 0;
+}
 
-	missing = 0;
-	for (uint32_t i = 0; i < arguments.threads; ++i) {
-		for (uint32_t j = 0; j < arguments.size; ++j) {
-			size_t global_index = get_global_index(i, j);
-			char *string = get_string(global_index);
-			if (!hash_table_v2_contains(hash_table_v2, string)) {
-				++missing;
+/* Map --keys privately, so its newlines can be turned into terminators
+   without copying the file first, and index its first threads * size
+   lines.  Blank lines are skipped and a CR before a newline is dropped. */
+static int load_keys(void)
+{
+	int fd = open(arguments.keys, O_RDONLY | O_CLOEXEC);
+	struct stat stat;
+	if (fd == -1 || fstat(fd, &stat) != 0) {
+		int err = errno;
+		fprintf(stderr, "cannot read %s: %s\n", arguments.keys, strerror(err));
+		return err;
+	}
+	data_bytes = stat.st_size;
+	/* The last line may not end in a newline, so reserve a zero byte after
+	   the file to terminate it with, then map the file over the start */
+	data = mmap(NULL, data_bytes + 1, PROT_READ | PROT_WRITE,
+	            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (data != MAP_FAILED && data_bytes != 0
+	    && mmap(data, data_bytes, PROT_READ | PROT_WRITE,
+	            MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		data = MAP_FAILED;
+	}
+	int err = errno;
+	close(fd);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "cannot map %s: %s\n", arguments.keys, strerror(err));
+		return err;
+	}
+
+	size_t needed = (size_t) arguments.threads * arguments.size;
+	key_offsets = calloc(needed == 0 ? 1 : needed, sizeof(size_t));
+	assert(key_offsets != NULL);
+	size_t keys = 0;
+	char *line = data;
+	char *end = data + data_bytes;
+	while (keys < needed && line < end) {
+		char *newline = memchr(line, '\n', end - line);
+		if (newline == NULL) {
+			newline = end;
+		}
+		*newline = 0;
+		if (newline > line && newline[-1] == '\r') {
+			newline[-1] = 0;
+		}
+		if (*line != 0) {
+			key_offsets[keys++] = line - data;
+		}
+		line = newline + 1;
+	}
+	if (keys < needed) {
+		fprintf(stderr, "%s has %zu keys, %zu are needed\n", arguments.keys, keys, needed);
+		return EINVAL;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	arguments.threads = 4;
+	arguments.size = 25000;
+	parse_tables("base,v1,v2", arguments.tables);
+	arguments.shard_counts = 1;
+	arguments.locks[0] = HASH_TABLE_LOCK_MUTEX;
+	arguments.lock_kinds = 1;
+	arguments.ops = UINT32_MAX;
+	arguments.theta = 0.99;
+	arguments.key_length[0] = BYTES_PER_STRING - 1;
+	arguments.key_length[1] = BYTES_PER_STRING - 1;
+	arguments.repeat = 1;
+  
+	static struct argp argp = { options, parse_opt };
+	argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+	setlocale(LC_ALL, "en_US.UTF-8");
+
+	if (arguments.csv != NULL) {
+		csv = fopen(arguments.csv, "w");
+		if (csv == NULL) {
+			int err = errno;
+			fprintf(stderr, "cannot write %s: %s\n", arguments.csv, strerror(err));
+			return err;
+		}
+		fprintf(csv, "table,hash,lock,shards,threads,size,readers,batch,warmup,runs,"
+		             "min_nsec,median_nsec,mean_nsec,stddev_nsec,max_nsec,missing\n");
+	}
+	if (arguments.json != NULL) {
+		json = fopen(arguments.json, "w");
+		if (json == NULL) {
+			int err = errno;
+			fprintf(stderr, "cannot write %s: %s\n", arguments.json, strerror(err));
+			return err;
+		}
+		fprintf(json, "[");
+	}
+
+	/* Writers first, then the readers */
+	pthread_t *threads = calloc(arguments.threads + arguments.readers, sizeof(pthread_t));
+
+	struct timespec start, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int err = arguments.keys != NULL ? load_keys() : run_generate_keys(threads);
+	if (err != 0) {
+		return err;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("Generation: %'lu usec\n", usec_diff(&start, &end));
+
+	if (arguments.ops == UINT32_MAX) {
+		arguments.ops = arguments.size;
+	}
+	if (arguments.mix[0] + arguments.mix[1] + arguments.mix[2] != 0) {
+		init_key_distribution((size_t) arguments.threads * arguments.size,
+		                      arguments.zipf, arguments.theta);
+	}
+
+	if (arguments.hash_report) {
+		for (const struct hash_function *function = hash_functions;
+		     function->name != NULL;
+		     ++function) {
+			report_hash(function);
+		}
+	}
+
+	for (size_t i = 0; i < NUM_IMPLS; ++i) {
+		if (!arguments.tables[i]) {
+			continue;
+		}
+		/* Sharded tables run once per shard count, to compare scaling, and
+		   tables with bucket locks once per kind of lock */
+		size_t runs = impls[i].shards != NULL ? arguments.shard_counts : 1;
+		size_t lock_runs = impls[i].bucket_locks ? arguments.lock_kinds : 1;
+		for (size_t j = 0; j < runs; ++j) {
+			for (size_t k = 0; k < lock_runs; ++k) {
+				hash_table_options.shards = arguments.shards[j];
+				hash_table_options.lock = arguments.locks[k];
+				err = run_table(&impls[i], threads);
+				if (err != 0) {
+					return err;
+				}
 			}
 		}
 	}
-	printf("  - %'lu missing\n", missing);
-	hash_table_v2_destroy(hash_table_v2);
+
+	if (csv != NULL) {
+		fclose(csv);
+	}
+	if (json != NULL) {
+		fprintf(json, "\n]\n");
+		fclose(json);
+	}
 
 	free(threads);
-	free(data);
+	if (key_offsets != NULL) {
+		munmap(data, data_bytes + 1);
+		free(key_offsets);
+	}
+	else {
+		free(data);
+	}
 
 	return 0;
 }
@@ -1,19 +1,25 @@
-#include "hash-table-base.h"
+#include "hash-table-v1.h"
+
+#include "hash-table-arena.h"
+#include "hash-table-instrument.h"
 
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/queue.h>
-#include <errno.h>
 
 #include <pthread.h>
 
 struct list_entry
 {
 	const char *key;
+	uint32_t hash;
+	uint32_t length;
 	uint32_t value;
 	SLIST_ENTRY(list_entry)
 	pointers;
+	/* The key itself, when the table owns it and it is short */
+	char inline_key[];
 };
 
 SLIST_HEAD(list_head, list_entry);
@@ -21,115 +27,407 @@ SLIST_HEAD(list_head, list_entry);
 struct hash_table_entry
 {
 	struct list_head list_head;
+	struct bucket_stats stats;
 };
 
 struct hash_table_v1
 {
-	struct hash_table_entry entries[HASH_TABLE_CAPACITY];
-	pthread_mutex_t lock;
+	hash_function_t hash;
+	/* Where list entries come from, or NULL to use calloc */
+	struct arena *arena;
+	/* Copy keys into the table instead of pointing at the caller's */
+	bool own_keys;
+	struct hash_table_entry *entries;
+	/* Always a power of two */
+	size_t capacity;
+	size_t size;
+	/* Adds hold this exclusively, contains and get_value hold it shared,
+	   so lookups can run alongside each other and alongside resizes */
+	pthread_rwlock_t lock;
+	struct lock_stats lock_stats;
 };
 
+static void lock_table(struct hash_table_v1 *hash_table, bool exclusive)
+{
+	int err = instrument_rwlock_lock(&hash_table->lock, exclusive, &hash_table->lock_stats);
+	if (err != 0)
+	{
+		exit(err);
+	}
+}
+
+static void unlock_table(struct hash_table_v1 *hash_table)
+{
+	int err = pthread_rwlock_unlock(&hash_table->lock);
+	if (err != 0)
+	{
+		exit(err);
+	}
+}
+
+static struct hash_table_entry *allocate_entries(size_t capacity)
+{
+	struct hash_table_entry *entries = calloc(capacity, sizeof(struct hash_table_entry));
+	assert(entries != NULL);
+	for (size_t i = 0; i < capacity; ++i)
+	{
+		struct hash_table_entry *entry = &entries[i];
+		SLIST_INIT(&entry->list_head);
+	}
+	return entries;
+}
+
 struct hash_table_v1 *hash_table_v1_create()
 {
 	struct hash_table_v1 *hash_table = calloc(1, sizeof(struct hash_table_v1));
 	assert(hash_table != NULL);
-	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i)
+	hash_table->hash = hash_table_options.hash;
+	hash_table->arena = hash_table_options.arena ? arena_create() : NULL;
+	hash_table->own_keys = hash_table_options.own_keys;
+	hash_table->capacity = HASH_TABLE_CAPACITY;
+	hash_table->entries = allocate_entries(hash_table->capacity);
+	/* Readers overtaking a waiting writer by default (as glibc does) would
+	   starve adds under a read-heavy load */
+	pthread_rwlockattr_t attr;
+	pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+	int err = pthread_rwlock_init(&hash_table->lock, &attr);
+	if (err != 0)
 	{
-		struct hash_table_entry *entry = &hash_table->entries[i];
-		SLIST_INIT(&entry->list_head);
+		exit(err);
 	}
+	pthread_rwlockattr_destroy(&attr);
 	return hash_table;
 }
 
 static struct hash_table_entry *get_hash_table_entry(struct hash_table_v1 *hash_table,
-													 const char *key)
+													 uint32_t hash)
 {
-	assert(key != NULL);
-	uint32_t index = bernstein_hash(key) % HASH_TABLE_CAPACITY;
+	uint32_t index = hash & (hash_table->capacity - 1);
 	struct hash_table_entry *entry = &hash_table->entries[index];
 	return entry;
 }
 
+/* Size of an entry holding a key of LENGTH bytes.  Short keys the table
+   owns are stored right after the entry, so comparing them reads the
+   entry's own cache line. */
+static size_t list_entry_size(struct hash_table_v1 *hash_table, uint32_t length)
+{
+	bool inline_key = hash_table->own_keys && length < HASH_TABLE_INLINE_KEY;
+	return sizeof(struct list_entry) + (inline_key ? length + 1 : 0);
+}
+
+/* Tables that own their keys copy them, inline or into the arena */
+static const char *copy_key(struct hash_table_v1 *hash_table,
+							struct list_entry *list_entry,
+							const struct hashed_key *key)
+{
+	if (!hash_table->own_keys)
+	{
+		return key->key;
+	}
+	char *copy = key->length < HASH_TABLE_INLINE_KEY ? list_entry->inline_key
+	           : hash_table->arena != NULL ? arena_alloc(hash_table->arena, key->length + 1)
+	           : malloc(key->length + 1);
+	assert(copy != NULL);
+	memcpy(copy, key->key, key->length + 1);
+	return copy;
+}
+
+static struct list_entry *allocate_list_entry(struct hash_table_v1 *hash_table,
+											  const struct hashed_key *key)
+{
+	size_t size = list_entry_size(hash_table, key->length);
+	struct list_entry *list_entry = hash_table->arena != NULL
+		? arena_alloc(hash_table->arena, size)
+		: calloc(1, size);
+	assert(list_entry != NULL);
+	list_entry->key = copy_key(hash_table, list_entry, key);
+	list_entry->hash = key->hash;
+	list_entry->length = key->length;
+	return list_entry;
+}
+
+static void free_list_entry(struct hash_table_v1 *hash_table,
+							struct list_entry *list_entry)
+{
+	size_t size = list_entry_size(hash_table, list_entry->length);
+	bool long_key = hash_table->own_keys && list_entry->length >= HASH_TABLE_INLINE_KEY;
+	if (hash_table->arena != NULL)
+	{
+		if (long_key)
+		{
+			arena_free(hash_table->arena, (char *) list_entry->key, list_entry->length + 1);
+		}
+		arena_free(hash_table->arena, list_entry, size);
+	}
+	else
+	{
+		if (long_key)
+		{
+			free((char *) list_entry->key);
+		}
+		free(list_entry);
+	}
+}
+
+/* Double the number of buckets and move every node over to its new bucket.
+   Every add already holds the table lock, so this simply rehashes in place;
+   no other writer can be running. */
+static void grow(struct hash_table_v1 *hash_table)
+{
+	struct hash_table_entry *old_entries = hash_table->entries;
+	size_t old_capacity = hash_table->capacity;
+
+	hash_table->capacity = old_capacity * 2;
+	hash_table->entries = allocate_entries(hash_table->capacity);
+
+	for (size_t i = 0; i < old_capacity; ++i)
+	{
+		struct list_head *old_head = &old_entries[i].list_head;
+		while (!SLIST_EMPTY(old_head))
+		{
+			struct list_entry *list_entry = SLIST_FIRST(old_head);
+			SLIST_REMOVE_HEAD(old_head, pointers);
+			struct hash_table_entry *entry = get_hash_table_entry(hash_table, list_entry->hash);
+			SLIST_INSERT_HEAD(&entry->list_head, list_entry, pointers);
+		}
+	}
+	free(old_entries);
+}
+
 static struct list_entry *get_list_entry(struct hash_table_v1 *hash_table,
-										 const char *key,
+										 const struct hashed_key *key,
 										 struct list_head *list_head)
 {
-	assert(key != NULL);
-
 	struct list_entry *entry = NULL;
+	uint64_t nodes = 0;
+	uint64_t key_compares = 0;
 
 	SLIST_FOREACH(entry, list_head, pointers)
 	{
-		if (strcmp(entry->key, key) == 0)
+		++nodes;
+		/* Almost every other key is ruled out by hash and length alone */
+		if (entry->hash != key->hash || entry->length != key->length)
+		{
+			continue;
+		}
+		++key_compares;
+		if (memcmp(entry->key, key->key, key->length) == 0)
 		{
-			return entry;
+			break;
 		}
 	}
-	return NULL;
+	count_lookup(nodes, key_compares);
+	return entry;
 }
 
 bool hash_table_v1_contains(struct hash_table_v1 *hash_table,
 							const char *key)
 {
-	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, key);
+	assert(key != NULL);
+	struct hashed_key hashed_key = get_hashed_key(hash_table->hash, key);
+	lock_table(hash_table, false);
+	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, hashed_key.hash);
+	count_bucket_hit(&hash_table_entry->stats);
 	struct list_head *list_head = &hash_table_entry->list_head;
-	struct list_entry *list_entry = get_list_entry(hash_table, key, list_head);
-	return list_entry != NULL;
+	struct list_entry *list_entry = get_list_entry(hash_table, &hashed_key, list_head);
+	bool found = list_entry != NULL;
+	unlock_table(hash_table);
+	return found;
 }
 
-void hash_table_v1_add_entry(struct hash_table_v1 *hash_table,
-							 const char *key,
+/* Called with the table lock held exclusively */
+static void add_hashed_entry(struct hash_table_v1 *hash_table,
+							 const struct hashed_key *hashed_key,
 							 uint32_t value)
 {
-	if(pthread_mutex_lock(&(hash_table->lock)) == -1){
-		exit(errno);
-	}
-	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, key);
+	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, hashed_key->hash);
+	count_bucket_hit(&hash_table_entry->stats);
 	struct list_head *list_head = &hash_table_entry->list_head;
-	struct list_entry *list_entry = get_list_entry(hash_table, key, list_head);
+	struct list_entry *list_entry = get_list_entry(hash_table, hashed_key, list_head);
 
 	/* Update the value if it already exists */
 	if (list_entry != NULL)
 	{
 		list_entry->value = value;
-		return;
 	}
+	else
+	{
+		list_entry = allocate_list_entry(hash_table, hashed_key);
+		list_entry->value = value;
+		SLIST_INSERT_HEAD(list_head, list_entry, pointers);
+
+		++hash_table->size;
+		if (hash_table->size > hash_table->capacity * HASH_TABLE_MAX_LOAD)
+		{
+			grow(hash_table);
+		}
+	}
+}
+
+void hash_table_v1_add_entry(struct hash_table_v1 *hash_table,
+							 const char *key,
+							 uint32_t value)
+{
+	assert(key != NULL);
+	/* Hashing does not touch the table, so it can happen before locking */
+	struct hashed_key hashed_key = get_hashed_key(hash_table->hash, key);
+	lock_table(hash_table, true);
+	add_hashed_entry(hash_table, &hashed_key, value);
+	unlock_table(hash_table);
+}
 
-	list_entry = calloc(1, sizeof(struct list_entry));
-	list_entry->key = key;
-	list_entry->value = value;
-	SLIST_INSERT_HEAD(list_head, list_entry, pointers);
-	if(pthread_mutex_unlock(&(hash_table->lock)) == -1){
-		exit(errno);
+/* The keys of a batch are hashed before taking the lock, and the lock is
+   then taken once per HASH_TABLE_BATCH keys instead of once per key.  The
+   buckets are all prefetched first so their misses overlap. */
+void hash_table_v1_add_batch(struct hash_table_v1 *hash_table,
+							 const char **keys,
+							 const uint32_t *values,
+							 size_t n)
+{
+	struct hashed_key hashed_keys[HASH_TABLE_BATCH];
+	for (size_t start = 0; start < n; start += HASH_TABLE_BATCH)
+	{
+		size_t count = n - start < HASH_TABLE_BATCH ? n - start : HASH_TABLE_BATCH;
+		for (size_t i = 0; i < count; ++i)
+		{
+			assert(keys[start + i] != NULL);
+			hashed_keys[i] = get_hashed_key(hash_table->hash, keys[start + i]);
+		}
+		lock_table(hash_table, true);
+		for (size_t i = 0; i < count; ++i)
+		{
+			__builtin_prefetch(get_hash_table_entry(hash_table, hashed_keys[i].hash));
+		}
+		for (size_t i = 0; i < count; ++i)
+		{
+			add_hashed_entry(hash_table, &hashed_keys[i], values[start + i]);
+		}
+		unlock_table(hash_table);
 	}
 }
 
 uint32_t hash_table_v1_get_value(struct hash_table_v1 *hash_table,
 								 const char *key)
 {
-	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, key);
+	assert(key != NULL);
+	struct hashed_key hashed_key = get_hashed_key(hash_table->hash, key);
+	lock_table(hash_table, false);
+	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, hashed_key.hash);
+	count_bucket_hit(&hash_table_entry->stats);
 	struct list_head *list_head = &hash_table_entry->list_head;
-	struct list_entry *list_entry = get_list_entry(hash_table, key, list_head);
+	struct list_entry *list_entry = get_list_entry(hash_table, &hashed_key, list_head);
 	assert(list_entry != NULL);
-	return list_entry->value;
+	uint32_t value = list_entry->value;
+	unlock_table(hash_table);
+	return value;
 }
 
-void hash_table_v1_destroy(struct hash_table_v1 *hash_table)
+/* Lookups hold the table lock shared, so once a node is unlinked under the
+   exclusive lock nobody can be looking at it and it can be freed at once */
+bool hash_table_v1_remove(struct hash_table_v1 *hash_table,
+						  const char *key)
 {
-	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i)
+	assert(key != NULL);
+	struct hashed_key hashed_key = get_hashed_key(hash_table->hash, key);
+	lock_table(hash_table, true);
+	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, hashed_key.hash);
+	count_bucket_hit(&hash_table_entry->stats);
+	struct list_head *list_head = &hash_table_entry->list_head;
+	struct list_entry *list_entry = get_list_entry(hash_table, &hashed_key, list_head);
+	if (list_entry != NULL)
+	{
+		SLIST_REMOVE(list_head, list_entry, list_entry, pointers);
+		free_list_entry(hash_table, list_entry);
+		--hash_table->size;
+	}
+	unlock_table(hash_table);
+	return list_entry != NULL;
+}
+
+#ifdef HASH_TABLE_INSTRUMENT
+/* Bucket hits are only those since the last resize, which starts every
+   bucket of the new array at zero */
+void hash_table_v1_instrument(struct hash_table_v1 *hash_table,
+							  struct instrument_report *report)
+{
+	instrument_report_lock(report, "table lock", &hash_table->lock_stats);
+	for (size_t i = 0; i < hash_table->capacity; ++i)
 	{
 		struct hash_table_entry *entry = &hash_table->entries[i];
-		struct list_head *list_head = &entry->list_head;
+		size_t length = 0;
 		struct list_entry *list_entry = NULL;
-		while (!SLIST_EMPTY(list_head))
+		SLIST_FOREACH(list_entry, &entry->list_head, pointers)
 		{
-			list_entry = SLIST_FIRST(list_head);
-			SLIST_REMOVE_HEAD(list_head, pointers);
-			free(list_entry);
+			++length;
 		}
+		instrument_report_bucket(report, i, length, &entry->stats);
 	}
-	if(pthread_mutex_destroy(&(hash_table->lock)) == -1){
-		exit(errno);
+}
+#endif
+
+size_t hash_table_v1_buckets(struct hash_table_v1 *hash_table)
+{
+	return hash_table->capacity;
+}
+
+bool hash_table_v1_next(struct hash_table_v1 *hash_table,
+						struct hash_table_cursor *cursor,
+						const char **key,
+						uint32_t *value)
+{
+	if (hash_table_cursor_pop(cursor, key, value))
+	{
+		return true;
+	}
+	/* Copy the next non-empty bucket out in one go, so the key handed
+	   back cannot be freed by a remove once the lock is dropped */
+	lock_table(hash_table, false);
+	while (cursor->copied_count == 0 && cursor->bucket < cursor->end
+	       && cursor->bucket < hash_table->capacity)
+	{
+		struct list_head *list_head = &hash_table->entries[cursor->bucket].list_head;
+		struct list_entry *list_entry = NULL;
+		SLIST_FOREACH(list_entry, list_head, pointers)
+		{
+			hash_table_cursor_copy(cursor, list_entry->key, list_entry->length, list_entry->value);
+		}
+		++cursor->bucket;
+	}
+	unlock_table(hash_table);
+	return hash_table_cursor_pop(cursor, key, value);
+}
+
+void hash_table_v1_destroy(struct hash_table_v1 *hash_table)
+{
+	/* Arena entries are all freed along with the arena */
+	if (hash_table->arena != NULL)
+	{
+		arena_destroy(hash_table->arena);
+	}
+	else
+	{
+		for (size_t i = 0; i < hash_table->capacity; ++i)
+		{
+			struct hash_table_entry *entry = &hash_table->entries[i];
+			struct list_head *list_head = &entry->list_head;
+			struct list_entry *list_entry = NULL;
+			while (!SLIST_EMPTY(list_head))
+			{
+				list_entry = SLIST_FIRST(list_head);
+				SLIST_REMOVE_HEAD(list_head, pointers);
+				free_list_entry(hash_table, list_entry);
+			}
+		}
+	}
+	free(hash_table->entries);
+	int err = pthread_rwlock_destroy(&hash_table->lock);
+	if (err != 0)
+	{
+		exit(err);
 	}
 	free(hash_table);
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "hash-table-common.h"
+#include "hash-table-instrument.h"
 
 #include <stdbool.h>
 
@@ -9,8 +10,31 @@ struct hash_table_v1 *hash_table_v1_create();
 void hash_table_v1_add_entry(struct hash_table_v1 *hash_table,
                              const char *key,
                              uint32_t value);
+/* Same as calling add_entry for each of the N keys in turn */
+void hash_table_v1_add_batch(struct hash_table_v1 *hash_table,
+                             const char **keys,
+                             const uint32_t *values,
+                             size_t n);
 bool hash_table_v1_contains(struct hash_table_v1 *hash_table,
                             const char *key);
 uint32_t hash_table_v1_get_value(struct hash_table_v1 *hash_table,
                                  const char* key);
+bool hash_table_v1_remove(struct hash_table_v1 *hash_table,
+                          const char *key);
 void hash_table_v1_destroy(struct hash_table_v1 *hash_table);
+/* Number of buckets, for iterating with struct hash_table_cursor */
+size_t hash_table_v1_buckets(struct hash_table_v1 *hash_table);
+/* Return the next entry of CURSOR's buckets in KEY and VALUE, or false once
+   there are none left.  Entries added or removed during the iteration may
+   or may not be returned. */
+bool hash_table_v1_next(struct hash_table_v1 *hash_table,
+                        struct hash_table_cursor *cursor,
+                        const char **key,
+                        uint32_t *value);
+
+#ifdef HASH_TABLE_INSTRUMENT
+/* Add the table's lock and bucket counters to REPORT.  Only call this
+   while no other thread is using the table. */
+void hash_table_v1_instrument(struct hash_table_v1 *hash_table,
+                              struct instrument_report *report);
+#endif
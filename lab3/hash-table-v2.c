@@ -1,125 +1,970 @@
-#include "hash-table-base.h"
+#include "hash-table-v2.h"
+
+#include "hash-table-arena.h"
+#include "hash-table-epoch.h"
+#include "hash-table-instrument.h"
+#include "hash-table-lock.h"
 
 #include <assert.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/queue.h>
-#include <errno.h>
 
 #include <pthread.h>
 
 struct list_entry {
 	const char *key;
+	uint32_t hash;
+	uint32_t length;
 	uint32_t value;
 	SLIST_ENTRY(list_entry) pointers;
+	/* The key itself, when the table owns it and it is short */
+	char inline_key[];
 };
 
 SLIST_HEAD(list_head, list_entry);
 
+/* Every bucket has its own lock, so inserts into different buckets never
+   wait on each other.  The alignment pads each bucket out to a full cache
+   line, otherwise two threads locking neighbouring buckets would still
+   bounce the same line between cores.
+
+   Lookups take no bucket lock at all.  An add publishes a fully written
+   node with one release store to the head of the chain, so a reader
+   walking the chain at the same time sees either the old or the new list,
+   both of which are valid.  Moving nodes to a new array during a resize is
+   the only change a reader could trip over, so the bucket's sequence
+   number is odd while that happens and lookups retry if it changed under
+   them (a seqlock), or if the bucket turns out to have been migrated.  A
+   removed node is unlinked under the bucket lock with its own next pointer
+   left intact, so a reader standing on it carries on down the chain; it is
+   only freed once no lookup can still be inside it (see
+   hash-table-epoch.h). */
 struct hash_table_entry {
+	struct hash_table_lock lock;
 	struct list_head list_head;
+	_Atomic uint32_t sequence;
+	/* Set once the nodes have been moved to the new array during a resize */
+	_Atomic bool migrated;
+	struct lock_stats lock_stats;
+	struct bucket_stats stats;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/* Number of old buckets an add moves over while a resize is running */
+#define MIGRATION_BATCH 8
+
+/* The size is kept in several counters so concurrent adds do not all
+   increment the same cache line.  Each thread sticks to one of them, and
+   the total is only summed every SIZE_CHECK_INTERVAL adds per counter. */
+#define SIZE_COUNTERS 16
+#define SIZE_CHECK_INTERVAL 1024
+
+struct size_counter {
+	_Atomic size_t count;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/* A bucket array.  The table publishes the one in use through an atomic
+   pointer, which every operation loads inside an epoch, and a replaced
+   array is only freed once every thread inside an epoch has left it.  So
+   there is no table-wide lock: whatever array a thread loaded stays
+   allocated until it leaves its epoch, and after locking a bucket it only has to check
+   the bucket was not migrated in the meantime. */
+struct bucket_array {
+	/* Always a power of two */
+	size_t capacity;
+	/* The array being migrated from, NULL unless a resize is running */
+	_Atomic(struct bucket_array *) old;
+	/* How far the migration into this array has got.  Kept here rather
+	   than in the table, so a thread still looking at an earlier resize
+	   cannot disturb a later one. */
+	_Atomic size_t next_migration;
+	_Atomic size_t migrated;
+	struct hash_table_entry entries[];
 };
 
+/* Resizing is incremental.  Growing allocates a new bucket array twice the
+   size, and from then on every add moves a few buckets of the old array
+   over (plus the old bucket its own key maps to) before inserting into the
+   new one.  A key therefore lives in the old array only while its old
+   bucket has not been migrated yet.  No thread ever rehashes the whole
+   table at once, and only the threads starting and finishing a resize
+   coordinate, through the resizing flag. */
 struct hash_table_v2 {
-	struct hash_table_entry entries[HASH_TABLE_CAPACITY];
-	pthread_mutex_t lock;
+	/* What the locks of bucket arrays freed after a resize counted */
+	struct lock_stats old_bucket_locks;
+	hash_function_t hash;
+	/* Where list entries come from, or NULL to use calloc */
+	struct arena *arena;
+	/* Copy keys into the table instead of pointing at the caller's */
+	bool own_keys;
+	/* Holds removed entries until no lookup can be reading them */
+	struct epoch *epoch;
+	/* What the bucket locks are, see hash-table-lock.h */
+	enum hash_table_lock_kind lock;
+	/* The bucket array in use, only loaded inside an epoch */
+	_Atomic(struct bucket_array *) buckets;
+	/* Set from the moment a resize is started until it has finished, and
+	   while a snapshot is open */
+	atomic_flag resizing;
+	/* The open snapshot, if any.  Writers read it with their bucket locked,
+	   see hash_table_v2_snapshot_begin. */
+	_Atomic(struct hash_table_v2_snapshot *) snapshot;
+	struct size_counter size[SIZE_COUNTERS];
 };
 
-struct hash_table_v2 *hash_table_v2_create()
+/* A bucket's entries as they were when a snapshot was taken */
+struct captured_bucket {
+	size_t count;
+	struct {
+		const char *key;
+		uint32_t value;
+	} entries[];
+};
+
+/* Every bucket that was empty shares this one */
+static struct captured_bucket empty_bucket;
+
+/* A snapshot is copy-on-write, one bucket at a time.  A writer about to
+   change a bucket first copies its entries for the snapshot, unless that
+   already happened, and the snapshot's readers copy every bucket nobody
+   has changed yet as they get to it.  Resizes are held off until the
+   snapshot ends, so bucket numbers stay put. */
+struct hash_table_v2_snapshot {
+	struct hash_table_v2 *hash_table;
+	struct bucket_array *array;
+	size_t capacity;
+	/* NULL until the bucket is copied, which happens under its lock */
+	struct captured_bucket **buckets;
+};
+
+static _Atomic unsigned int next_size_counter;
+static _Thread_local int size_counter = -1;
+
+static void lock_entry(struct hash_table_entry *entry)
 {
-	struct hash_table_v2 *hash_table = calloc(1, sizeof(struct hash_table_v2));
-	assert(hash_table != NULL);
-	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
-		struct hash_table_entry *entry = &hash_table->entries[i];
+	hash_table_lock_acquire(&entry->lock, &entry->lock_stats);
+}
+
+static void unlock_entry(struct hash_table_entry *entry)
+{
+	hash_table_lock_release(&entry->lock);
+}
+
+static struct bucket_array *load_buckets(struct hash_table_v2 *hash_table)
+{
+	return atomic_load_explicit(&hash_table->buckets, memory_order_acquire);
+}
+
+static struct bucket_array *allocate_buckets(size_t capacity,
+                                             enum hash_table_lock_kind lock)
+{
+	size_t size = sizeof(struct bucket_array) + capacity * sizeof(struct hash_table_entry);
+	struct bucket_array *array = aligned_alloc(CACHE_LINE_SIZE, size);
+	assert(array != NULL);
+	memset(array, 0, size);
+	array->capacity = capacity;
+	for (size_t i = 0; i < capacity; ++i) {
+		struct hash_table_entry *entry = &array->entries[i];
+		hash_table_lock_init(&entry->lock, lock);
 		SLIST_INIT(&entry->list_head);
 	}
+	return array;
+}
+
+/* Size of an entry holding a key of LENGTH bytes.  Short keys the table
+   owns are stored right after the entry, so comparing them reads the
+   entry's own cache line. */
+static size_t list_entry_size(struct hash_table_v2 *hash_table, uint32_t length)
+{
+	bool inline_key = hash_table->own_keys && length < HASH_TABLE_INLINE_KEY;
+	return sizeof(struct list_entry) + (inline_key ? length + 1 : 0);
+}
+
+/* Tables that own their keys copy them, inline or into the arena */
+static const char *copy_key(struct hash_table_v2 *hash_table,
+                            struct list_entry *list_entry,
+                            const struct hashed_key *key)
+{
+	if (!hash_table->own_keys) {
+		return key->key;
+	}
+	char *copy = key->length < HASH_TABLE_INLINE_KEY ? list_entry->inline_key
+	           : hash_table->arena != NULL ? arena_alloc(hash_table->arena, key->length + 1)
+	           : malloc(key->length + 1);
+	assert(copy != NULL);
+	memcpy(copy, key->key, key->length + 1);
+	return copy;
+}
+
+static struct list_entry *allocate_list_entry(struct hash_table_v2 *hash_table,
+                                              const struct hashed_key *key)
+{
+	size_t size = list_entry_size(hash_table, key->length);
+	struct list_entry *list_entry = hash_table->arena != NULL
+		? arena_alloc(hash_table->arena, size)
+		: calloc(1, size);
+	assert(list_entry != NULL);
+	list_entry->key = copy_key(hash_table, list_entry, key);
+	list_entry->hash = key->hash;
+	list_entry->length = key->length;
+	return list_entry;
+}
+
+/* Also called by the epoch once a removed entry can no longer be reached */
+static void free_list_entry(void *context, void *object)
+{
+	struct hash_table_v2 *hash_table = context;
+	struct list_entry *list_entry = object;
+	size_t size = list_entry_size(hash_table, list_entry->length);
+	bool long_key = hash_table->own_keys && list_entry->length >= HASH_TABLE_INLINE_KEY;
+	if (hash_table->arena != NULL) {
+		if (long_key) {
+			arena_free(hash_table->arena, (char *) list_entry->key, list_entry->length + 1);
+		}
+		arena_free(hash_table->arena, list_entry, size);
+	}
+	else {
+		if (long_key) {
+			free((char *) list_entry->key);
+		}
+		free(list_entry);
+	}
+}
+
+/* Free ARRAY along with any nodes still in it, adding what its bucket
+   locks counted to the table's total.  Arena nodes are left for
+   arena_destroy. */
+static void free_buckets(struct hash_table_v2 *hash_table, struct bucket_array *array)
+{
+	for (size_t i = 0; i < array->capacity; ++i) {
+		struct hash_table_entry *entry = &array->entries[i];
+		struct list_head *list_head = &entry->list_head;
+		struct list_entry *list_entry = NULL;
+		while (hash_table->arena == NULL && !SLIST_EMPTY(list_head)) {
+			list_entry = SLIST_FIRST(list_head);
+			SLIST_REMOVE_HEAD(list_head, pointers);
+			free_list_entry(hash_table, list_entry);
+		}
+		merge_lock_stats(&hash_table->old_bucket_locks, &entry->lock_stats);
+		hash_table_lock_destroy(&entry->lock);
+	}
+	free(array);
+}
+
+struct hash_table_v2 *hash_table_v2_create()
+{
+	struct hash_table_v2 *hash_table = aligned_alloc(CACHE_LINE_SIZE,
+	                                                 sizeof(struct hash_table_v2));
+	assert(hash_table != NULL);
+	memset(hash_table, 0, sizeof(struct hash_table_v2));
+	hash_table->hash = hash_table_options.hash;
+	hash_table->arena = hash_table_options.arena ? arena_create() : NULL;
+	hash_table->own_keys = hash_table_options.own_keys;
+	hash_table->epoch = epoch_create(free_list_entry, hash_table);
+	hash_table->lock = hash_table_options.lock;
+	atomic_init(&hash_table->buckets, allocate_buckets(HASH_TABLE_CAPACITY, hash_table->lock));
+	atomic_flag_clear(&hash_table->resizing);
 	return hash_table;
 }
 
-static struct hash_table_entry *get_hash_table_entry(struct hash_table_v2 *hash_table,
-                                                     const char *key)
+/* Return the bucket HASH belongs in according to ARRAY.  By the time the
+   caller looks at it, a later resize may have migrated it, which its
+   migrated flag then says. */
+static struct hash_table_entry *get_hash_table_entry(struct bucket_array *array,
+                                                     uint32_t hash)
 {
-	assert(key != NULL);
-	uint32_t index = bernstein_hash(key) % HASH_TABLE_CAPACITY;
-	struct hash_table_entry *entry = &hash_table->entries[index];
-	return entry;
+	struct bucket_array *old = atomic_load_explicit(&array->old, memory_order_acquire);
+	if (old != NULL) {
+		struct hash_table_entry *entry = &old->entries[hash & (old->capacity - 1)];
+		if (!atomic_load_explicit(&entry->migrated, memory_order_acquire)) {
+			return entry;
+		}
+	}
+	return &array->entries[hash & (array->capacity - 1)];
+}
+
+/* Move the nodes of bucket INDEX of OLD over to ARRAY.  Returns true if
+   this call did the move, false if the bucket had already been moved.
+   Nothing is added to the two new buckets the nodes can land in until this
+   bucket is marked migrated, so only the old bucket's lock is needed. */
+static bool migrate_entry(struct bucket_array *array,
+                          struct bucket_array *old,
+                          size_t index)
+{
+	struct hash_table_entry *old_entry = &old->entries[index];
+	lock_entry(old_entry);
+	if (old_entry->migrated) {
+		unlock_entry(old_entry);
+		return false;
+	}
+
+	/* Readers can be walking this chain, so the pointers are rewritten with
+	   atomic stores, inside an odd sequence number.  The new buckets are
+	   not looked at until the release store to migrated below. */
+	uint32_t sequence = atomic_load_explicit(&old_entry->sequence, memory_order_relaxed);
+	atomic_store_explicit(&old_entry->sequence, sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	struct list_head *old_head = &old_entry->list_head;
+	size_t mask = array->capacity - 1;
+	struct list_entry *list_entry = SLIST_FIRST(old_head);
+	while (list_entry != NULL) {
+		struct list_entry *next = SLIST_NEXT(list_entry, pointers);
+		size_t new_index = list_entry->hash & mask;
+		struct list_head *list_head = &array->entries[new_index].list_head;
+		__atomic_store_n(&SLIST_NEXT(list_entry, pointers), SLIST_FIRST(list_head),
+		                 __ATOMIC_RELAXED);
+		__atomic_store_n(&SLIST_FIRST(list_head), list_entry, __ATOMIC_RELAXED);
+		list_entry = next;
+	}
+	__atomic_store_n(&SLIST_FIRST(old_head), NULL, __ATOMIC_RELAXED);
+
+	atomic_store_explicit(&old_entry->migrated, true, memory_order_release);
+	atomic_store_explicit(&old_entry->sequence, sequence + 2, memory_order_release);
+	unlock_entry(old_entry);
+	return true;
+}
+
+/* Do this add's share of migrating OLD into ARRAY, if a resize is running.
+   Returns true if the caller migrated the last old bucket and so has to
+   finish the resize.  Called inside an epoch. */
+static bool migrate_some(struct bucket_array *array, uint32_t hash)
+{
+	struct bucket_array *old = atomic_load_explicit(&array->old, memory_order_acquire);
+	if (old == NULL) {
+		return false;
+	}
+	size_t moved = 0;
+
+	size_t start = atomic_fetch_add_explicit(&array->next_migration,
+	                                         MIGRATION_BATCH,
+	                                         memory_order_relaxed);
+	for (size_t i = start; i < start + MIGRATION_BATCH && i < old->capacity; ++i) {
+		moved += migrate_entry(array, old, i);
+	}
+	moved += migrate_entry(array, old, hash & (old->capacity - 1));
+
+	if (moved == 0) {
+		return false;
+	}
+	size_t total = atomic_fetch_add(&array->migrated, moved) + moved;
+	return total == old->capacity;
+}
+
+static void start_resize(struct hash_table_v2 *hash_table)
+{
+	/* Only one resize runs at a time, and only its starter and finisher
+	   ever change the array pointers */
+	if (atomic_flag_test_and_set(&hash_table->resizing)) {
+		return;
+	}
+	struct bucket_array *old = atomic_load_explicit(&hash_table->buckets, memory_order_relaxed);
+	struct bucket_array *array = allocate_buckets(old->capacity * 2, hash_table->lock);
+	atomic_init(&array->old, old);
+	atomic_store_explicit(&hash_table->buckets, array, memory_order_release);
+}
+
+/* Called, outside any epoch, by the thread that migrated the last bucket
+   of ARRAY's old array.  Nobody can load the old array once it is
+   unhooked, and those that already did are inside an epoch, so it is
+   freed as soon as they have all left.  Waiting for that here, rather
+   than retiring the array, means a table that only grows never holds on
+   to the arrays it outgrew, and their lock counts are in the table's
+   total from the moment the resize is over. */
+static void finish_resize(struct hash_table_v2 *hash_table, struct bucket_array *array)
+{
+	struct bucket_array *old = atomic_load_explicit(&array->old, memory_order_relaxed);
+	atomic_store_explicit(&array->old, NULL, memory_order_release);
+	epoch_synchronize(hash_table->epoch);
+	free_buckets(hash_table, old);
+	atomic_flag_clear(&hash_table->resizing);
+}
+
+/* Move every old bucket still left, for a caller that cannot wait for
+   adds to finish a running resize */
+static void migrate_all(struct hash_table_v2 *hash_table)
+{
+	bool finish = false;
+	epoch_enter(hash_table->epoch);
+	struct bucket_array *array = load_buckets(hash_table);
+	struct bucket_array *old = atomic_load_explicit(&array->old, memory_order_acquire);
+	if (old != NULL) {
+		size_t moved = 0;
+		for (size_t i = 0; i < old->capacity; ++i) {
+			moved += migrate_entry(array, old, i);
+		}
+		finish = moved != 0
+		         && atomic_fetch_add(&array->migrated, moved) + moved == old->capacity;
+	}
+	epoch_exit(hash_table->epoch);
+	if (finish) {
+		finish_resize(hash_table, array);
+	}
+}
+
+/* Count one more entry, and every so often check if the table is now
+   loaded enough to grow.  Called inside an epoch. */
+static bool count_entry(struct hash_table_v2 *hash_table)
+{
+	if (size_counter < 0) {
+		size_counter = atomic_fetch_add(&next_size_counter, 1) % SIZE_COUNTERS;
+	}
+	size_t count = atomic_fetch_add_explicit(&hash_table->size[size_counter].count, 1,
+	                                         memory_order_relaxed) + 1;
+	if (count % SIZE_CHECK_INTERVAL != 0) {
+		return false;
+	}
+	struct bucket_array *array = load_buckets(hash_table);
+	if (atomic_load_explicit(&array->old, memory_order_relaxed) != NULL) {
+		return false;
+	}
+
+	size_t size = 0;
+	for (size_t i = 0; i < SIZE_COUNTERS; ++i) {
+		size += atomic_load_explicit(&hash_table->size[i].count, memory_order_relaxed);
+	}
+	return size > array->capacity * HASH_TABLE_MAX_LOAD;
+}
+
+/* The counters are only ever summed, so a thread removing an entry some
+   other thread counted is fine */
+static void uncount_entry(struct hash_table_v2 *hash_table)
+{
+	if (size_counter < 0) {
+		size_counter = atomic_fetch_add(&next_size_counter, 1) % SIZE_COUNTERS;
+	}
+	atomic_fetch_sub_explicit(&hash_table->size[size_counter].count, 1,
+	                          memory_order_relaxed);
 }
 
 static struct list_entry *get_list_entry(struct hash_table_v2 *hash_table,
-                                         const char *key,
+                                         const struct hashed_key *key,
                                          struct list_head *list_head)
 {
-	assert(key != NULL);
-
 	struct list_entry *entry = NULL;
-	
-	SLIST_FOREACH(entry, list_head, pointers) {
-	  if (strcmp(entry->key, key) == 0) {
-	    return entry;
-	  }
+	uint64_t nodes = 0;
+	uint64_t key_compares = 0;
+
+	/* Acquire pairs with the release store publishing each node */
+	for (entry = __atomic_load_n(&SLIST_FIRST(list_head), __ATOMIC_ACQUIRE);
+	     entry != NULL;
+	     entry = __atomic_load_n(&SLIST_NEXT(entry, pointers), __ATOMIC_ACQUIRE)) {
+		++nodes;
+		/* Almost every other key is ruled out by hash and length alone */
+		if (entry->hash != key->hash || entry->length != key->length) {
+			continue;
+		}
+		++key_compares;
+		if (memcmp(entry->key, key->key, key->length) == 0) {
+			break;
+		}
 	}
-	return NULL;
+	count_lookup(nodes, key_compares);
+	return entry;
+}
+
+/* Look KEY up without taking its bucket lock, storing its value in VALUE
+   if it is found.  The epoch keeps the bucket array it reads from, and
+   any node it stands on, from being freed under it. */
+static bool lookup(struct hash_table_v2 *hash_table,
+                   const struct hashed_key *key,
+                   uint32_t *value)
+{
+	epoch_enter(hash_table->epoch);
+	while (true) {
+		struct hash_table_entry *entry = get_hash_table_entry(load_buckets(hash_table),
+		                                                      key->hash);
+		uint32_t sequence = atomic_load_explicit(&entry->sequence, memory_order_acquire);
+		if (sequence % 2 == 1) {
+			sched_yield();
+			continue;
+		}
+		/* Migrated is set before the sequence is even again, so a bucket
+		   migrated before the sequence was read says so here */
+		if (atomic_load_explicit(&entry->migrated, memory_order_relaxed)) {
+			continue;
+		}
+
+		struct list_entry *list_entry = get_list_entry(hash_table, key, &entry->list_head);
+		if (list_entry != NULL) {
+			*value = __atomic_load_n(&list_entry->value, __ATOMIC_RELAXED);
+		}
+
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&entry->sequence, memory_order_relaxed) == sequence) {
+			count_bucket_hit(&entry->stats);
+			epoch_exit(hash_table->epoch);
+			return list_entry != NULL;
+		}
+	}
+}
+
+bool hash_table_v2_contains_hashed(struct hash_table_v2 *hash_table,
+                                   const struct hashed_key *key)
+{
+	uint32_t value;
+	return lookup(hash_table, key, &value);
 }
 
 bool hash_table_v2_contains(struct hash_table_v2 *hash_table,
                             const char *key)
 {
-	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, key);
+	assert(key != NULL);
+	struct hashed_key hashed_key = get_hashed_key(hash_table->hash, key);
+	return hash_table_v2_contains_hashed(hash_table, &hashed_key);
+}
+
+static struct hash_table_v2_snapshot *load_snapshot(struct hash_table_v2 *hash_table)
+{
+	return atomic_load_explicit(&hash_table->snapshot, memory_order_acquire);
+}
+
+/* Copy HASH_TABLE_ENTRY for the open snapshot, if there is one and it
+   does not have the bucket yet.  Called with the bucket's lock held, and
+   by writers before they change anything in it. */
+static void capture_entry(struct hash_table_v2 *hash_table,
+                          struct hash_table_v2_snapshot *snapshot,
+                          struct hash_table_entry *hash_table_entry)
+{
+	if (snapshot == NULL) {
+		return;
+	}
+	struct captured_bucket **captured = &snapshot->buckets[hash_table_entry - snapshot->array->entries];
+	if (__atomic_load_n(captured, __ATOMIC_RELAXED) != NULL) {
+		return;
+	}
+
 	struct list_head *list_head = &hash_table_entry->list_head;
-	struct list_entry *list_entry = get_list_entry(hash_table, key, list_head);
-	return list_entry != NULL;
+	struct list_entry *list_entry = NULL;
+	size_t count = 0;
+	SLIST_FOREACH(list_entry, list_head, pointers) {
+		++count;
+	}
+	struct captured_bucket *copy = &empty_bucket;
+	if (count != 0) {
+		copy = malloc(sizeof(struct captured_bucket) + count * sizeof(copy->entries[0]));
+		assert(copy != NULL);
+		copy->count = 0;
+		SLIST_FOREACH(list_entry, list_head, pointers) {
+			copy->entries[copy->count].key = list_entry->key;
+			copy->entries[copy->count].value = __atomic_load_n(&list_entry->value,
+			                                                   __ATOMIC_RELAXED);
+			++copy->count;
+		}
+	}
+	__atomic_store_n(captured, copy, __ATOMIC_RELEASE);
 }
 
-void hash_table_v2_add_entry(struct hash_table_v2 *hash_table,
-                             const char *key,
-                             uint32_t value)
+/* Add KEY to HASH_TABLE_ENTRY, whose lock is held.  The lookup has to
+   happen under the bucket lock as well, otherwise two threads adding the
+   same key could both miss it and insert twice.  Returns true if the table
+   should grow. */
+static bool add_locked(struct hash_table_v2 *hash_table,
+                       struct hash_table_entry *hash_table_entry,
+                       const struct hashed_key *key,
+                       uint32_t value)
 {
-	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, key);
 	struct list_head *list_head = &hash_table_entry->list_head;
 	struct list_entry *list_entry = get_list_entry(hash_table, key, list_head);
+	capture_entry(hash_table, load_snapshot(hash_table), hash_table_entry);
 
 	/* Update the value if it already exists */
 	if (list_entry != NULL) {
-		list_entry->value = value;
-		return;
+		__atomic_store_n(&list_entry->value, value, __ATOMIC_RELAXED);
+		return false;
 	}
 
-	list_entry = calloc(1, sizeof(struct list_entry));
-	list_entry->key = key;
-	list_entry->value = value;	
-	if(pthread_mutex_lock(&(hash_table->lock)) == -1){
-		exit(errno);
+	list_entry = allocate_list_entry(hash_table, key);
+	list_entry->value = value;
+	SLIST_NEXT(list_entry, pointers) = SLIST_FIRST(list_head);
+	/* Publish the node only once it is completely written */
+	__atomic_store_n(&SLIST_FIRST(list_head), list_entry, __ATOMIC_RELEASE);
+	return count_entry(hash_table);
+}
+
+/* Lock and return the bucket HASH currently belongs in.  Called inside an
+   epoch.  A bucket can be migrated by a resize after it was picked but
+   before it was locked, in which case the array is loaded again. */
+static struct hash_table_entry *lock_hash_table_entry(struct hash_table_v2 *hash_table,
+                                                      uint32_t hash)
+{
+	while (true) {
+		struct hash_table_entry *entry = get_hash_table_entry(load_buckets(hash_table), hash);
+		lock_entry(entry);
+		if (!atomic_load_explicit(&entry->migrated, memory_order_relaxed)) {
+			count_bucket_hit(&entry->stats);
+			return entry;
+		}
+		unlock_entry(entry);
+	}
+}
+
+void hash_table_v2_add_hashed(struct hash_table_v2 *hash_table,
+                              const struct hashed_key *key,
+                              uint32_t value)
+{
+	epoch_enter(hash_table->epoch);
+	/* Once the key's old bucket has been migrated it can only be in the
+	   new array, which is where get_hash_table_entry then points */
+	struct bucket_array *array = load_buckets(hash_table);
+	bool finish = migrate_some(array, key->hash);
+	struct hash_table_entry *hash_table_entry = lock_hash_table_entry(hash_table, key->hash);
+	bool grow = add_locked(hash_table, hash_table_entry, key, value);
+	unlock_entry(hash_table_entry);
+	epoch_exit(hash_table->epoch);
+
+	if (finish) {
+		finish_resize(hash_table, array);
 	}
-	SLIST_INSERT_HEAD(list_head, list_entry, pointers);
-	if(pthread_mutex_unlock(&(hash_table->lock)) == -1){
-		exit(errno);
+	else if (grow) {
+		start_resize(hash_table);
 	}
 }
 
+void hash_table_v2_add_entry(struct hash_table_v2 *hash_table,
+                             const char *key,
+                             uint32_t value)
+{
+	assert(key != NULL);
+	struct hashed_key hashed_key = get_hashed_key(hash_table->hash, key);
+	hash_table_v2_add_hashed(hash_table, &hashed_key, value);
+}
+
+/* Add up to HASH_TABLE_BATCH keys.  They are hashed and their buckets
+   prefetched up front, then sorted by bucket so that keys sharing one
+   only lock it once.  The sort is stable, so a key that appears twice
+   still ends up with its last value. */
+static void add_batch(struct hash_table_v2 *hash_table,
+                      const struct hashed_key *hashed_keys,
+                      const uint32_t *values,
+                      size_t count)
+{
+	struct hash_table_entry *entries[HASH_TABLE_BATCH];
+	uint8_t order[HASH_TABLE_BATCH];
+	bool finish = false;
+	bool grow = false;
+	struct bucket_array *array = NULL;
+
+	epoch_enter(hash_table->epoch);
+	/* The same share of a running resize as adding the keys one by one */
+	array = load_buckets(hash_table);
+	for (size_t i = 0; i < count; ++i) {
+		finish |= migrate_some(array, hashed_keys[i].hash);
+	}
+	for (size_t i = 0; i < count; ++i) {
+		entries[i] = get_hash_table_entry(array, hashed_keys[i].hash);
+		__builtin_prefetch(entries[i], 1);
+		order[i] = i;
+		for (size_t j = i;
+		     j > 0 && (uintptr_t) entries[order[j - 1]] > (uintptr_t) entries[order[j]];
+		     --j) {
+			uint8_t swap = order[j - 1];
+			order[j - 1] = order[j];
+			order[j] = swap;
+		}
+	}
+
+	for (size_t i = 0; i < count;) {
+		struct hash_table_entry *entry = entries[order[i]];
+		size_t end = i + 1;
+		while (end < count && entries[order[end]] == entry) {
+			++end;
+		}
+
+		lock_entry(entry);
+		if (!atomic_load_explicit(&entry->migrated, memory_order_relaxed)) {
+			for (size_t j = i; j < end; ++j) {
+				grow |= add_locked(hash_table, entry, &hashed_keys[order[j]], values[order[j]]);
+			}
+			unlock_entry(entry);
+		}
+		else {
+			/* Migrated since it was picked, so the keys may now belong
+			   in different buckets */
+			unlock_entry(entry);
+			for (size_t j = i; j < end; ++j) {
+				const struct hashed_key *key = &hashed_keys[order[j]];
+				struct hash_table_entry *new_entry = lock_hash_table_entry(hash_table, key->hash);
+				grow |= add_locked(hash_table, new_entry, key, values[order[j]]);
+				unlock_entry(new_entry);
+			}
+		}
+		i = end;
+	}
+	epoch_exit(hash_table->epoch);
+
+	if (finish) {
+		finish_resize(hash_table, array);
+	}
+	else if (grow) {
+		start_resize(hash_table);
+	}
+}
+
+void hash_table_v2_add_batch(struct hash_table_v2 *hash_table,
+                             const char **keys,
+                             const uint32_t *values,
+                             size_t n)
+{
+	struct hashed_key hashed_keys[HASH_TABLE_BATCH];
+	for (size_t start = 0; start < n; start += HASH_TABLE_BATCH) {
+		size_t count = n - start < HASH_TABLE_BATCH ? n - start : HASH_TABLE_BATCH;
+		for (size_t i = 0; i < count; ++i) {
+			assert(keys[start + i] != NULL);
+			hashed_keys[i] = get_hashed_key(hash_table->hash, keys[start + i]);
+		}
+		add_batch(hash_table, hashed_keys, values + start, count);
+	}
+}
+
+void hash_table_v2_add_batch_hashed(struct hash_table_v2 *hash_table,
+                                    const struct hashed_key *keys,
+                                    const uint32_t *values,
+                                    size_t n)
+{
+	for (size_t start = 0; start < n; start += HASH_TABLE_BATCH) {
+		size_t count = n - start < HASH_TABLE_BATCH ? n - start : HASH_TABLE_BATCH;
+		add_batch(hash_table, keys + start, values + start, count);
+	}
+}
+
+uint32_t hash_table_v2_get_value_hashed(struct hash_table_v2 *hash_table,
+                                        const struct hashed_key *key)
+{
+	uint32_t value = 0;
+	bool found = lookup(hash_table, key, &value);
+	assert(found);
+	(void) found;
+	return value;
+}
+
 uint32_t hash_table_v2_get_value(struct hash_table_v2 *hash_table,
                                  const char *key)
 {
-	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, key);
+	assert(key != NULL);
+	struct hashed_key hashed_key = get_hashed_key(hash_table->hash, key);
+	return hash_table_v2_get_value_hashed(hash_table, &hashed_key);
+}
+
+bool hash_table_v2_remove_hashed(struct hash_table_v2 *hash_table,
+                                 const struct hashed_key *key)
+{
+	epoch_enter(hash_table->epoch);
+	struct bucket_array *array = load_buckets(hash_table);
+	bool finish = migrate_some(array, key->hash);
+	struct hash_table_entry *hash_table_entry = lock_hash_table_entry(hash_table, key->hash);
 	struct list_head *list_head = &hash_table_entry->list_head;
+
 	struct list_entry *list_entry = get_list_entry(hash_table, key, list_head);
-	assert(list_entry != NULL);
-	return list_entry->value;
+	if (list_entry != NULL) {
+		capture_entry(hash_table, load_snapshot(hash_table), hash_table_entry);
+		struct list_entry **link = &SLIST_FIRST(list_head);
+		while (*link != list_entry) {
+			link = &SLIST_NEXT(*link, pointers);
+		}
+		__atomic_store_n(link, SLIST_NEXT(list_entry, pointers), __ATOMIC_RELEASE);
+		uncount_entry(hash_table);
+		epoch_retire(hash_table->epoch, list_entry);
+	}
+	unlock_entry(hash_table_entry);
+	epoch_exit(hash_table->epoch);
+
+	if (finish) {
+		finish_resize(hash_table, array);
+	}
+	return list_entry != NULL;
 }
 
-void hash_table_v2_destroy(struct hash_table_v2 *hash_table)
+bool hash_table_v2_remove(struct hash_table_v2 *hash_table,
+                          const char *key)
 {
-	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
-		struct hash_table_entry *entry = &hash_table->entries[i];
-		struct list_head *list_head = &entry->list_head;
+	assert(key != NULL);
+	struct hashed_key hashed_key = get_hashed_key(hash_table->hash, key);
+	return hash_table_v2_remove_hashed(hash_table, &hashed_key);
+}
+
+size_t hash_table_v2_buckets(struct hash_table_v2 *hash_table)
+{
+	epoch_enter(hash_table->epoch);
+	size_t capacity = load_buckets(hash_table)->capacity;
+	epoch_exit(hash_table->epoch);
+	return capacity;
+}
+
+/* Lock and return the bucket holding the entries of bucket INDEX of
+   ARRAY.  Until the old bucket it splits off from is migrated, they are
+   still in there, mixed with those of its sibling.  Called inside an
+   epoch. */
+static struct hash_table_entry *lock_bucket(struct bucket_array *array, size_t index)
+{
+	struct bucket_array *old = atomic_load_explicit(&array->old, memory_order_acquire);
+	if (old != NULL) {
+		struct hash_table_entry *old_entry = &old->entries[index & (old->capacity - 1)];
+		lock_entry(old_entry);
+		if (!atomic_load_explicit(&old_entry->migrated, memory_order_relaxed)) {
+			return old_entry;
+		}
+		unlock_entry(old_entry);
+	}
+	struct hash_table_entry *entry = &array->entries[index];
+	lock_entry(entry);
+	return entry;
+}
+
+bool hash_table_v2_next(struct hash_table_v2 *hash_table,
+                        struct hash_table_cursor *cursor,
+                        const char **key,
+                        uint32_t *value)
+{
+	if (hash_table_cursor_pop(cursor, key, value)) {
+		return true;
+	}
+	/* Copy the next non-empty bucket out with it locked, so the key handed
+	   back cannot be freed by a remove once the lock is dropped */
+	epoch_enter(hash_table->epoch);
+	struct bucket_array *array = load_buckets(hash_table);
+	size_t mask = array->capacity - 1;
+	while (cursor->copied_count == 0 && cursor->bucket < cursor->end && cursor->bucket <= mask) {
+		struct hash_table_entry *entry = lock_bucket(array, cursor->bucket);
 		struct list_entry *list_entry = NULL;
-		while (!SLIST_EMPTY(list_head)) {
-			list_entry = SLIST_FIRST(list_head);
-			SLIST_REMOVE_HEAD(list_head, pointers);
-			free(list_entry);
+		SLIST_FOREACH(list_entry, &entry->list_head, pointers) {
+			if ((list_entry->hash & mask) == cursor->bucket) {
+				hash_table_cursor_copy(cursor, list_entry->key, list_entry->length,
+				                       __atomic_load_n(&list_entry->value, __ATOMIC_RELAXED));
+			}
 		}
+		unlock_entry(entry);
+		++cursor->bucket;
+	}
+	epoch_exit(hash_table->epoch);
+	return hash_table_cursor_pop(cursor, key, value);
+}
+
+/* Writers read the snapshot pointer with their bucket locked and keep it
+   locked until they are done, so once every bucket has been locked and
+   unlocked after the pointer changed, no writer is still using the old
+   value.  That is once per snapshot, not once per change. */
+static void wait_for_writers(struct bucket_array *array)
+{
+	for (size_t i = 0; i < array->capacity; ++i) {
+		lock_entry(&array->entries[i]);
+		unlock_entry(&array->entries[i]);
+	}
+}
+
+struct hash_table_v2_snapshot *hash_table_v2_snapshot_begin(struct hash_table_v2 *hash_table)
+{
+	/* Holding the resizing flag keeps resizes from starting, and since it
+	   is held for the whole of one, a running resize is finished first */
+	while (atomic_flag_test_and_set(&hash_table->resizing)) {
+		migrate_all(hash_table);
+		sched_yield();
+	}
+	/* Removed entries, and the keys they own, stay around until the
+	   snapshot ends.  With resizes held off, the array stays put too. */
+	epoch_enter(hash_table->epoch);
+
+	struct hash_table_v2_snapshot *snapshot = calloc(1, sizeof(struct hash_table_v2_snapshot));
+	assert(snapshot != NULL);
+	snapshot->hash_table = hash_table;
+	snapshot->array = load_buckets(hash_table);
+	snapshot->capacity = snapshot->array->capacity;
+	snapshot->buckets = calloc(snapshot->capacity, sizeof(struct captured_bucket *));
+	assert(snapshot->buckets != NULL);
+
+	atomic_store(&hash_table->snapshot, snapshot);
+	wait_for_writers(snapshot->array);
+	return snapshot;
+}
+
+size_t hash_table_v2_snapshot_buckets(struct hash_table_v2_snapshot *snapshot)
+{
+	return snapshot->capacity;
+}
+
+bool hash_table_v2_snapshot_next(struct hash_table_v2_snapshot *snapshot,
+                                 struct hash_table_cursor *cursor,
+                                 const char **key,
+                                 uint32_t *value)
+{
+	struct hash_table_v2 *hash_table = snapshot->hash_table;
+	while (cursor->bucket < cursor->end && cursor->bucket < snapshot->capacity) {
+		struct captured_bucket **captured = &snapshot->buckets[cursor->bucket];
+		struct captured_bucket *copy = __atomic_load_n(captured, __ATOMIC_ACQUIRE);
+		if (copy == NULL) {
+			struct hash_table_entry *entry = &snapshot->array->entries[cursor->bucket];
+			lock_entry(entry);
+			capture_entry(hash_table, snapshot, entry);
+			unlock_entry(entry);
+			copy = __atomic_load_n(captured, __ATOMIC_RELAXED);
+		}
+		if (cursor->position < copy->count) {
+			*key = copy->entries[cursor->position].key;
+			*value = copy->entries[cursor->position].value;
+			++cursor->position;
+			return true;
+		}
+		++cursor->bucket;
+		cursor->position = 0;
+	}
+	return false;
+}
+
+void hash_table_v2_snapshot_end(struct hash_table_v2_snapshot *snapshot)
+{
+	struct hash_table_v2 *hash_table = snapshot->hash_table;
+	atomic_store(&hash_table->snapshot, NULL);
+	wait_for_writers(snapshot->array);
+
+	for (size_t i = 0; i < snapshot->capacity; ++i) {
+		if (snapshot->buckets[i] != &empty_bucket) {
+			free(snapshot->buckets[i]);
+		}
+	}
+	free(snapshot->buckets);
+	free(snapshot);
+	epoch_exit(hash_table->epoch);
+	atomic_flag_clear(&hash_table->resizing);
+}
+
+#ifdef HASH_TABLE_INSTRUMENT
+/* Bucket lock counts include every array the table has had, but bucket
+   hits are only those since the array in use was allocated.  A resize
+   still running is finished first, so every entry is in the array the
+   chain lengths are taken from. */
+void hash_table_v2_instrument(struct hash_table_v2 *hash_table,
+                              struct instrument_report *report)
+{
+	migrate_all(hash_table);
+	struct bucket_array *array = load_buckets(hash_table);
+	instrument_report_lock(report, "bucket locks", &hash_table->old_bucket_locks);
+	for (size_t i = 0; i < array->capacity; ++i) {
+		struct hash_table_entry *entry = &array->entries[i];
+		size_t length = 0;
+		struct list_entry *list_entry = NULL;
+		SLIST_FOREACH(list_entry, &entry->list_head, pointers) {
+			++length;
+		}
+		instrument_report_lock(report, "bucket locks", &entry->lock_stats);
+		instrument_report_bucket(report, i, length, &entry->stats);
+	}
+}
+#endif
+
+void hash_table_v2_destroy(struct hash_table_v2 *hash_table)
+{
+	epoch_destroy(hash_table->epoch);
+	struct bucket_array *array = atomic_load(&hash_table->buckets);
+	struct bucket_array *old = atomic_load(&array->old);
+	if (old != NULL) {
+		free_buckets(hash_table, old);
 	}
-	if(pthread_mutex_destroy(&(hash_table->lock)) == -1){
-		exit(errno);
+	free_buckets(hash_table, array);
+	if (hash_table->arena != NULL) {
+		arena_destroy(hash_table->arena);
 	}
 	free(hash_table);
 }
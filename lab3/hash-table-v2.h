@@ -1,6 +1,7 @@
 #pragma once
 
 #include "hash-table-common.h"
+#include "hash-table-instrument.h"
 
 #include <stdbool.h>
 
@@ -9,8 +10,63 @@ struct hash_table_v2 *hash_table_v2_create();
 void hash_table_v2_add_entry(struct hash_table_v2 *hash_table,
                              const char *key,
                              uint32_t value);
+/* Same as calling add_entry for each of the N keys in turn */
+void hash_table_v2_add_batch(struct hash_table_v2 *hash_table,
+                             const char **keys,
+                             const uint32_t *values,
+                             size_t n);
 bool hash_table_v2_contains(struct hash_table_v2 *hash_table,
                             const char *key);
 uint32_t hash_table_v2_get_value(struct hash_table_v2 *hash_table,
                                  const char* key);
+bool hash_table_v2_remove(struct hash_table_v2 *hash_table,
+                          const char *key);
 void hash_table_v2_destroy(struct hash_table_v2 *hash_table);
+/* Number of buckets, for iterating with struct hash_table_cursor */
+size_t hash_table_v2_buckets(struct hash_table_v2 *hash_table);
+/* Return the next entry of CURSOR's buckets in KEY and VALUE, or false once
+   there are none left.  Entries added or removed during the iteration may
+   or may not be returned, and a resize during it can make it miss or
+   repeat any entry.  KEY belongs to CURSOR and is only good until the next
+   call with it. */
+bool hash_table_v2_next(struct hash_table_v2 *hash_table,
+                        struct hash_table_cursor *cursor,
+                        const char **key,
+                        uint32_t *value);
+
+/* A consistent view of the table as it was when the snapshot began, which
+   writers keep adding to and removing from in the meantime.  Resizes wait
+   until the snapshot ends, and so does freeing removed entries.  Only one
+   snapshot of a table can be open at a time, and it has to be ended by
+   the thread that began it, but any thread can iterate over it. */
+struct hash_table_v2_snapshot;
+struct hash_table_v2_snapshot *hash_table_v2_snapshot_begin(struct hash_table_v2 *hash_table);
+size_t hash_table_v2_snapshot_buckets(struct hash_table_v2_snapshot *snapshot);
+bool hash_table_v2_snapshot_next(struct hash_table_v2_snapshot *snapshot,
+                                 struct hash_table_cursor *cursor,
+                                 const char **key,
+                                 uint32_t *value);
+void hash_table_v2_snapshot_end(struct hash_table_v2_snapshot *snapshot);
+
+#ifdef HASH_TABLE_INSTRUMENT
+/* Add the table's lock and bucket counters to REPORT.  Only call this
+   while no other thread is using the table. */
+void hash_table_v2_instrument(struct hash_table_v2 *hash_table,
+                              struct instrument_report *report);
+#endif
+
+/* The same operations for callers that already hashed the key with the
+   table's hash function, like the sharded table */
+void hash_table_v2_add_hashed(struct hash_table_v2 *hash_table,
+                              const struct hashed_key *key,
+                              uint32_t value);
+void hash_table_v2_add_batch_hashed(struct hash_table_v2 *hash_table,
+                                    const struct hashed_key *keys,
+                                    const uint32_t *values,
+                                    size_t n);
+bool hash_table_v2_contains_hashed(struct hash_table_v2 *hash_table,
+                                   const struct hashed_key *key);
+uint32_t hash_table_v2_get_value_hashed(struct hash_table_v2 *hash_table,
+                                        const struct hashed_key *key);
+bool hash_table_v2_remove_hashed(struct hash_table_v2 *hash_table,
+                                 const struct hashed_key *key);
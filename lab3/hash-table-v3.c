@@ -0,0 +1,431 @@
+#include "hash-table-v3.h"
+
+#include "hash-table-arena.h"
+#include "hash-table-epoch.h"
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A lock-free version of the table.  Nodes are only ever pushed onto the
+   head of a bucket with a compare-and-swap, and once published a node only
+   changes its value, and its next pointer to mark or skip removed nodes.
+
+   Memory ordering: a writer fully initializes a node (key, value, next)
+   before the release CAS that makes it the new head.  Readers load the
+   head and every next pointer with acquire, which makes everything written
+   before the node was linked in visible.  Values are atomics so an update
+   racing with a reader is never torn; readers see either the old or new
+   value.
+
+   Removal follows Harris and Michael: a node is first deleted logically by
+   setting the low bit of its own next pointer, which also stops anyone
+   from linking a new node after it, and then unlinked with a CAS on its
+   predecessor's next pointer.  Whoever walks past a marked node while
+   looking for a key to remove helps unlink it.  Lookups simply skip marked
+   nodes.  Unlinked nodes may still be walked by other threads, so they are
+   retired to an epoch instead of freed (see hash-table-epoch.h). */
+
+struct list_entry {
+	const char *key;
+	uint32_t hash;
+	uint32_t length;
+	_Atomic uint32_t value;
+	/* The low bit is set once the node has been removed */
+	_Atomic(struct list_entry *) next;
+	/* The key itself, when the table owns it and it is short */
+	char inline_key[];
+};
+
+struct hash_table_entry {
+	_Atomic(struct list_entry *) head;
+};
+
+struct hash_table_v3 {
+	hash_function_t hash;
+	/* Where list entries come from, or NULL to use calloc */
+	struct arena *arena;
+	/* Copy keys into the table instead of pointing at the caller's */
+	bool own_keys;
+	/* Holds unlinked entries until no other thread can be reading them */
+	struct epoch *epoch;
+	struct hash_table_entry entries[HASH_TABLE_CAPACITY];
+};
+
+static bool is_removed(struct list_entry *next)
+{
+	return (uintptr_t) next & 1;
+}
+
+static struct list_entry *mark_removed(struct list_entry *next)
+{
+	return (struct list_entry *) ((uintptr_t) next | 1);
+}
+
+static struct list_entry *get_next(struct list_entry *next)
+{
+	return (struct list_entry *) ((uintptr_t) next & ~(uintptr_t) 1);
+}
+
+/* Size of an entry holding a key of LENGTH bytes.  Short keys the table
+   owns are stored right after the entry, so comparing them reads the
+   entry's own cache line. */
+static size_t list_entry_size(struct hash_table_v3 *hash_table, uint32_t length)
+{
+	bool inline_key = hash_table->own_keys && length < HASH_TABLE_INLINE_KEY;
+	return sizeof(struct list_entry) + (inline_key ? length + 1 : 0);
+}
+
+/* Tables that own their keys copy them, inline or into the arena */
+static const char *copy_key(struct hash_table_v3 *hash_table,
+                            struct list_entry *list_entry,
+                            const struct hashed_key *key)
+{
+	if (!hash_table->own_keys) {
+		return key->key;
+	}
+	char *copy = key->length < HASH_TABLE_INLINE_KEY ? list_entry->inline_key
+	           : hash_table->arena != NULL ? arena_alloc(hash_table->arena, key->length + 1)
+	           : malloc(key->length + 1);
+	assert(copy != NULL);
+	memcpy(copy, key->key, key->length + 1);
+	return copy;
+}
+
+static struct list_entry *allocate_list_entry(struct hash_table_v3 *hash_table,
+                                              const struct hashed_key *key)
+{
+	size_t size = list_entry_size(hash_table, key->length);
+	struct list_entry *list_entry = hash_table->arena != NULL
+		? arena_alloc(hash_table->arena, size)
+		: calloc(1, size);
+	assert(list_entry != NULL);
+	list_entry->key = copy_key(hash_table, list_entry, key);
+	list_entry->hash = key->hash;
+	list_entry->length = key->length;
+	return list_entry;
+}
+
+/* Called by the epoch once an unlinked entry can no longer be reached */
+static void free_list_entry(void *context, void *object)
+{
+	struct hash_table_v3 *hash_table = context;
+	struct list_entry *list_entry = object;
+	size_t size = list_entry_size(hash_table, list_entry->length);
+	bool long_key = hash_table->own_keys && list_entry->length >= HASH_TABLE_INLINE_KEY;
+	if (hash_table->arena != NULL) {
+		if (long_key) {
+			arena_free(hash_table->arena, (char *) list_entry->key, list_entry->length + 1);
+		}
+		arena_free(hash_table->arena, list_entry, size);
+	}
+	else {
+		if (long_key) {
+			free((char *) list_entry->key);
+		}
+		free(list_entry);
+	}
+}
+
+struct hash_table_v3 *hash_table_v3_create()
+{
+	struct hash_table_v3 *hash_table = calloc(1, sizeof(struct hash_table_v3));
+	assert(hash_table != NULL);
+	hash_table->hash = hash_table_options.hash;
+	hash_table->arena = hash_table_options.arena ? arena_create() : NULL;
+	hash_table->own_keys = hash_table_options.own_keys;
+	hash_table->epoch = epoch_create(free_list_entry, hash_table);
+	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
+		struct hash_table_entry *entry = &hash_table->entries[i];
+		atomic_init(&entry->head, NULL);
+	}
+	return hash_table;
+}
+
+static struct hash_table_entry *get_hash_table_entry(struct hash_table_v3 *hash_table,
+                                                     uint32_t hash)
+{
+	uint32_t index = hash % HASH_TABLE_CAPACITY;
+	struct hash_table_entry *entry = &hash_table->entries[index];
+	return entry;
+}
+
+static bool matches(struct list_entry *entry, const struct hashed_key *key)
+{
+	/* Almost every other key is ruled out by hash and length alone */
+	return entry->hash == key->hash && entry->length == key->length
+	       && memcmp(entry->key, key->key, key->length) == 0;
+}
+
+/* Walk the chain from FIRST, stopping before LAST (or at the end when LAST
+   is NULL), skipping removed nodes.  Only nodes between the two were
+   published after LAST.  If LAST itself was removed and unlinked in the
+   meantime this just walks the whole chain.  Called inside an epoch. */
+static struct list_entry *get_list_entry(const struct hashed_key *key,
+                                         struct list_entry *first,
+                                         struct list_entry *last)
+{
+	struct list_entry *entry = first;
+	uint64_t nodes = 0;
+	uint64_t key_compares = 0;
+
+	while (entry != last && entry != NULL) {
+		struct list_entry *next = atomic_load_explicit(&entry->next, memory_order_acquire);
+		++nodes;
+		if (!is_removed(next) && entry->hash == key->hash && entry->length == key->length) {
+			++key_compares;
+			if (memcmp(entry->key, key->key, key->length) == 0) {
+				break;
+			}
+		}
+		entry = get_next(next);
+	}
+	count_lookup(nodes, key_compares);
+	return entry != last ? entry : NULL;
+}
+
+/* Find KEY for removal, unlinking any removed nodes on the way.  LINK is
+   set to the pointer that pointed at the returned node.  Called inside an
+   epoch. */
+static struct list_entry *find_for_remove(struct hash_table_v3 *hash_table,
+                                          struct hash_table_entry *hash_table_entry,
+                                          const struct hashed_key *key,
+                                          _Atomic(struct list_entry *) **link)
+{
+retry:
+	*link = &hash_table_entry->head;
+	struct list_entry *entry = atomic_load_explicit(*link, memory_order_acquire);
+	while (entry != NULL) {
+		struct list_entry *next = atomic_load_explicit(&entry->next, memory_order_acquire);
+		if (is_removed(next)) {
+			/* Fails if the predecessor was removed (its next pointer is
+			   marked) or changed, then start over from the head */
+			struct list_entry *expected = entry;
+			if (!atomic_compare_exchange_strong_explicit(*link, &expected, get_next(next),
+			                                             memory_order_acq_rel,
+			                                             memory_order_acquire)) {
+				goto retry;
+			}
+			epoch_retire(hash_table->epoch, entry);
+			entry = get_next(next);
+			continue;
+		}
+		if (matches(entry, key)) {
+			return entry;
+		}
+		*link = &entry->next;
+		entry = next;
+	}
+	return NULL;
+}
+
+bool hash_table_v3_contains(struct hash_table_v3 *hash_table,
+                            const char *key)
+{
+	assert(key != NULL);
+	struct hashed_key hashed_key = get_hashed_key(hash_table->hash, key);
+	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, hashed_key.hash);
+	epoch_enter(hash_table->epoch);
+	struct list_entry *head = atomic_load_explicit(&hash_table_entry->head,
+	                                               memory_order_acquire);
+	struct list_entry *list_entry = get_list_entry(&hashed_key, head, NULL);
+	epoch_exit(hash_table->epoch);
+	return list_entry != NULL;
+}
+
+/* Called inside an epoch */
+static void add_hashed_entry(struct hash_table_v3 *hash_table,
+                             const struct hashed_key *key,
+                             uint32_t value)
+{
+	struct hashed_key hashed_key = *key;
+	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, hashed_key.hash);
+	struct list_entry *head = atomic_load_explicit(&hash_table_entry->head,
+	                                               memory_order_acquire);
+	struct list_entry *list_entry = get_list_entry(&hashed_key, head, NULL);
+
+	/* Update the value if it already exists */
+	if (list_entry != NULL) {
+		atomic_store_explicit(&list_entry->value, value, memory_order_release);
+		return;
+	}
+
+	struct list_entry *new_entry = allocate_list_entry(hash_table, &hashed_key);
+	atomic_init(&new_entry->value, value);
+	atomic_init(&new_entry->next, head);
+	struct list_entry *first = head;
+
+	/* On failure the CAS reloads head.  Another thread may have added the
+	   same key in the meantime, so only the newly published nodes need to
+	   be checked before trying again. */
+	while (!atomic_compare_exchange_weak_explicit(&hash_table_entry->head,
+	                                              &first,
+	                                              new_entry,
+	                                              memory_order_release,
+	                                              memory_order_acquire)) {
+		list_entry = get_list_entry(&hashed_key, first, head);
+		if (list_entry != NULL) {
+			atomic_store_explicit(&list_entry->value, value, memory_order_release);
+			/* Never published, so nobody else can have seen it */
+			free_list_entry(hash_table, new_entry);
+			return;
+		}
+		head = first;
+		atomic_store_explicit(&new_entry->next, first, memory_order_relaxed);
+	}
+}
+
+void hash_table_v3_add_entry(struct hash_table_v3 *hash_table,
+                             const char *key,
+                             uint32_t value)
+{
+	assert(key != NULL);
+	struct hashed_key hashed_key = get_hashed_key(hash_table->hash, key);
+	epoch_enter(hash_table->epoch);
+	add_hashed_entry(hash_table, &hashed_key, value);
+	epoch_exit(hash_table->epoch);
+}
+
+/* There are no locks to amortize, but hashing the whole batch and
+   prefetching every bucket head first still overlaps the misses, and the
+   epoch is only entered once per batch */
+void hash_table_v3_add_batch(struct hash_table_v3 *hash_table,
+                             const char **keys,
+                             const uint32_t *values,
+                             size_t n)
+{
+	struct hashed_key hashed_keys[HASH_TABLE_BATCH];
+	for (size_t start = 0; start < n; start += HASH_TABLE_BATCH) {
+		size_t count = n - start < HASH_TABLE_BATCH ? n - start : HASH_TABLE_BATCH;
+		for (size_t i = 0; i < count; ++i) {
+			assert(keys[start + i] != NULL);
+			hashed_keys[i] = get_hashed_key(hash_table->hash, keys[start + i]);
+			__builtin_prefetch(get_hash_table_entry(hash_table, hashed_keys[i].hash), 1);
+		}
+		epoch_enter(hash_table->epoch);
+		for (size_t i = 0; i < count; ++i) {
+			add_hashed_entry(hash_table, &hashed_keys[i], values[start + i]);
+		}
+		epoch_exit(hash_table->epoch);
+	}
+}
+
+uint32_t hash_table_v3_get_value(struct hash_table_v3 *hash_table,
+                                 const char *key)
+{
+	assert(key != NULL);
+	struct hashed_key hashed_key = get_hashed_key(hash_table->hash, key);
+	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, hashed_key.hash);
+	epoch_enter(hash_table->epoch);
+	struct list_entry *head = atomic_load_explicit(&hash_table_entry->head,
+	                                               memory_order_acquire);
+	struct list_entry *list_entry = get_list_entry(&hashed_key, head, NULL);
+	assert(list_entry != NULL);
+	uint32_t value = atomic_load_explicit(&list_entry->value, memory_order_acquire);
+	epoch_exit(hash_table->epoch);
+	return value;
+}
+
+bool hash_table_v3_remove(struct hash_table_v3 *hash_table,
+                          const char *key)
+{
+	assert(key != NULL);
+	struct hashed_key hashed_key = get_hashed_key(hash_table->hash, key);
+	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, hashed_key.hash);
+	_Atomic(struct list_entry *) *link = NULL;
+	bool removed = false;
+
+	epoch_enter(hash_table->epoch);
+	while (!removed) {
+		struct list_entry *list_entry = find_for_remove(hash_table, hash_table_entry,
+		                                                &hashed_key, &link);
+		if (list_entry == NULL) {
+			break;
+		}
+		/* Marking is what removes the key; if another remove got there
+		   first, look again in case the key was added back since */
+		struct list_entry *next = atomic_load_explicit(&list_entry->next,
+		                                               memory_order_acquire);
+		if (is_removed(next)
+		    || !atomic_compare_exchange_strong_explicit(&list_entry->next, &next,
+		                                                mark_removed(next),
+		                                                memory_order_acq_rel,
+		                                                memory_order_acquire)) {
+			continue;
+		}
+		removed = true;
+
+		/* If the predecessor changed, the next find unlinks it instead */
+		struct list_entry *expected = list_entry;
+		if (atomic_compare_exchange_strong_explicit(link, &expected, next,
+		                                            memory_order_acq_rel,
+		                                            memory_order_acquire)) {
+			epoch_retire(hash_table->epoch, list_entry);
+		}
+		else {
+			find_for_remove(hash_table, hash_table_entry, &hashed_key, &link);
+		}
+	}
+	epoch_exit(hash_table->epoch);
+	return removed;
+}
+
+size_t hash_table_v3_buckets(struct hash_table_v3 *hash_table)
+{
+	(void) hash_table;
+	return HASH_TABLE_CAPACITY;
+}
+
+/* Removed nodes are skipped, and do not count towards the position */
+bool hash_table_v3_next(struct hash_table_v3 *hash_table,
+                        struct hash_table_cursor *cursor,
+                        const char **key,
+                        uint32_t *value)
+{
+	if (hash_table_cursor_pop(cursor, key, value)) {
+		return true;
+	}
+	/* Copy the next non-empty bucket out while the epoch keeps its nodes,
+	   and the keys they own, from being freed */
+	epoch_enter(hash_table->epoch);
+	while (cursor->copied_count == 0 && cursor->bucket < cursor->end
+	       && cursor->bucket < HASH_TABLE_CAPACITY) {
+		struct hash_table_entry *entry = &hash_table->entries[cursor->bucket];
+		struct list_entry *list_entry = atomic_load_explicit(&entry->head, memory_order_acquire);
+		while (list_entry != NULL) {
+			struct list_entry *next = atomic_load_explicit(&list_entry->next, memory_order_acquire);
+			if (!is_removed(next)) {
+				hash_table_cursor_copy(cursor, list_entry->key, list_entry->length,
+				                       atomic_load_explicit(&list_entry->value, memory_order_relaxed));
+			}
+			list_entry = get_next(next);
+		}
+		++cursor->bucket;
+	}
+	epoch_exit(hash_table->epoch);
+	return hash_table_cursor_pop(cursor, key, value);
+}
+
+void hash_table_v3_destroy(struct hash_table_v3 *hash_table)
+{
+	/* Unlinked entries first, the ones still in the table below */
+	epoch_destroy(hash_table->epoch);
+	/* Arena entries are all freed along with the arena */
+	if (hash_table->arena != NULL) {
+		arena_destroy(hash_table->arena);
+	}
+	else {
+		for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
+			struct hash_table_entry *entry = &hash_table->entries[i];
+			struct list_entry *list_entry = atomic_load(&entry->head);
+			while (list_entry != NULL) {
+				struct list_entry *next = get_next(atomic_load(&list_entry->next));
+				free_list_entry(hash_table, list_entry);
+				list_entry = next;
+			}
+		}
+	}
+	free(hash_table);
+}
@@ -1,5 +1,8 @@
+import json
+import os
 import re
 import subprocess
+import tempfile
 import unittest
 
 class TestLab3(unittest.TestCase):
@@ -78,3 +81,329 @@ class TestLab3(unittest.TestCase):
         self.assertEqual(miss_1, 0, msg=f"The missing entries for Hash table v1 should be 0 but got {miss_1} instead.")
         self.assertEqual(miss_2, 0, msg=f"The missing entries for Hash table v2 should be 0 but got {miss_2} instead.")
         
+
+    def test_4(self):
+        print("Running tester code 4...")
+        self.assertTrue(self.make, msg='make failed')
+
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '8', '-s', '50000', '--tables', 'v3')).decode()
+        nums = re.sub(r'Generation: ([\d\,]+) usec\nHash table v3: ([\d\,]+) usec\n  - ([\d\,]+) missing\n',
+                      r'\1|\2|\3',
+                      hash_result)
+
+        _, _, miss_3 = nums.split('|')
+
+        miss_3 = int(miss_3.replace(",", ""))
+
+        self.assertEqual(miss_3, 0, msg=f"The missing entries for Hash table v3 should be 0 but got {miss_3} instead.")
+
+    def test_5(self):
+        print("Running tester code 5...")
+        self.assertTrue(self.make, msg='make failed')
+
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '8', '-s', '50000', '--tables', 'oa')).decode()
+        nums = re.sub(r'Generation: ([\d\,]+) usec\nHash table oa: ([\d\,]+) usec\n  - ([\d\,]+) missing\n',
+                      r'\1|\2|\3',
+                      hash_result)
+
+        _, _, miss_oa = nums.split('|')
+
+        miss_oa = int(miss_oa.replace(",", ""))
+
+        self.assertEqual(miss_oa, 0, msg=f"The missing entries for Hash table oa should be 0 but got {miss_oa} instead.")
+
+    def test_6(self):
+        print("Running tester code 6...")
+        self.assertTrue(self.make, msg='make failed')
+
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '8', '-s', '20000', '--tables', 'v2',
+                                               '--mix', '90:9:1', '--distribution', 'zipf', '--ops', '10000')).decode()
+        miss_2 = int(re.search(r'Hash table v2: [\d\,]+ usec\n  - ([\d\,]+) missing\n', hash_result).group(1).replace(",", ""))
+        ops = re.findall(r'  - (?:read|update|insert): ([\d\,]+) ops, p50 [\d\,]+ nsec, p99 [\d\,]+ nsec, p999 [\d\,]+ nsec\n', hash_result)
+        ops = sum(int(n.replace(",", "")) for n in ops)
+
+        self.assertEqual(miss_2, 0, msg=f"The missing entries for Hash table v2 should be 0 but got {miss_2} instead.")
+        self.assertEqual(ops, 80000, msg=f"The mixed workload should run 80000 operations but ran {ops} instead.")
+
+    def test_7(self):
+        print("Running tester code 7...")
+        self.assertTrue(self.make, msg='make failed')
+
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '4', '-s', '20000', '--tables', 'all',
+                                               '--remove', '--readers', '2')).decode()
+        results = re.findall(r'Hash table (\w+): [\d\,]+ usec\n(?:  - .*\n)*?  - ([\d\,]+) removed in [\d\,]+ usec, ([\d\,]+) left behind, ([\d\,]+) missing\n', hash_result)
+
+        names = {name for name, _, _, _ in results}
+        self.assertTrue({'base', 'v1', 'v2', 'v3', 'oa'} <= names, msg=f"Expected a removal line for every hash table but got {names}.")
+        for name, removed, left, missing in results:
+            removed = int(removed.replace(",", ""))
+            left = int(left.replace(",", ""))
+            missing = int(missing.replace(",", ""))
+            self.assertEqual(removed, 40000, msg=f"Hash table {name} should remove 40000 entries but removed {removed} instead.")
+            self.assertEqual(left, 0, msg=f"Hash table {name} should have no removed entries left but has {left}.")
+            self.assertEqual(missing, 0, msg=f"Hash table {name} should have no missing entries but got {missing}.")
+
+    def test_8(self):
+        print("Running tester code 8...")
+        self.assertTrue(self.make, msg='make failed')
+
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '8', '-s', '50000', '--tables', 'all',
+                                               '--batch', '20')).decode()
+        results = re.findall(r'Hash table (\w+): [\d\,]+ usec\n  - ([\d\,]+) missing\n', hash_result)
+
+        names = {name for name, _ in results}
+        self.assertTrue({'base', 'v1', 'v2', 'v3', 'oa'} <= names, msg=f"Expected results for every hash table but got {names}.")
+        for name, missing in results:
+            missing = int(missing.replace(",", ""))
+            self.assertEqual(missing, 0, msg=f"The missing entries for Hash table {name} should be 0 but got {missing} instead.")
+
+    def test_9(self):
+        print("Running tester code 9...")
+        self.assertTrue(self.make, msg='make failed')
+
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '8', '-s', '50000', '--tables', 'sharded',
+                                               '--shards', '1,3,8')).decode()
+        results = re.findall(r'Hash table sharded: [\d\,]+ usec\n  - ([\d\,]+) missing\n  - ([\d\,]+) shards?\n', hash_result)
+
+        self.assertEqual([shards for _, shards in results], ['1', '3', '8'], msg=f"Expected runs with 1, 3 and 8 shards but got {results}.")
+        for missing, shards in results:
+            missing = int(missing.replace(",", ""))
+            self.assertEqual(missing, 0, msg=f"The missing entries for Hash table sharded with {shards} shards should be 0 but got {missing} instead.")
+
+    def test_10(self):
+        print("Running tester code 10...")
+        self.assertTrue(self.make, msg='make failed')
+
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '4', '-s', '20000', '--tables', 'all',
+                                               '--own-keys', '--remove')).decode()
+        results = re.findall(r'Hash table (\w+): [\d\,]+ usec\n  - ([\d\,]+) missing\n(?:  - .*\n)*?  - ([\d\,]+) removed in [\d\,]+ usec, [\d\,]+ left behind, ([\d\,]+) missing\n', hash_result)
+
+        names = {name for name, _, _, _ in results}
+        self.assertTrue({'base', 'v1', 'v2', 'v3', 'oa'} <= names, msg=f"Expected a run of every hash table but got {names}.")
+        for name, missing, removed, missing_after in results:
+            missing = int(missing.replace(",", ""))
+            removed = int(removed.replace(",", ""))
+            missing_after = int(missing_after.replace(",", ""))
+            self.assertEqual(missing, 0, msg=f"The missing entries for Hash table {name} with owned keys should be 0 but got {missing} instead.")
+            self.assertEqual(removed, 40000, msg=f"Hash table {name} should remove 40000 entries but removed {removed} instead.")
+            self.assertEqual(missing_after, 0, msg=f"Hash table {name} should have no missing entries after removal but got {missing_after}.")
+
+    def test_11(self):
+        print("Running tester code 11...")
+        self.assertTrue(self.make, msg='make failed')
+
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '8', '-s', '20000', '--tables', 'v2',
+                                               '--lock', 'mutex,adaptive,elided', '--remove'),
+                                              stderr=subprocess.DEVNULL).decode()
+        results = re.findall(r'Hash table v2: [\d\,]+ usec\n  - ([\d\,]+) missing\n  - (\w+) bucket locks\n  - [\d\,]+ removed in [\d\,]+ usec, [\d\,]+ left behind, ([\d\,]+) missing\n', hash_result)
+
+        self.assertEqual([lock for _, lock, _ in results], ['mutex', 'adaptive', 'elided'], msg=f"Expected a run with every kind of bucket lock but got {results}.")
+        for missing, lock, missing_after in results:
+            missing = int(missing.replace(",", ""))
+            missing_after = int(missing_after.replace(",", ""))
+            self.assertEqual(missing, 0, msg=f"The missing entries for Hash table v2 with {lock} locks should be 0 but got {missing} instead.")
+            self.assertEqual(missing_after, 0, msg=f"Hash table v2 with {lock} locks should have no missing entries after removal but got {missing_after}.")
+
+    def test_12(self):
+        print("Running tester code 12...")
+        self.assertTrue(self.make, msg='make failed')
+
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '4', '-s', '20000', '--tables', 'all',
+                                               '--scan', '3')).decode()
+        results = re.findall(r'Hash table (\w+): [\d\,]+ usec\n  - ([\d\,]+) missing\n(?:  - .*\n)*?  - ([\d\,]+) entries \([\d\,]+ key bytes\) scanned by 3 threads', hash_result)
+
+        names = {name for name, _, _ in results}
+        self.assertTrue({'base', 'v1', 'v2', 'v3', 'oa', 'sharded'} <= names, msg=f"Expected a scan of every hash table but got {names}.")
+        for name, missing, scanned in results:
+            missing = int(missing.replace(",", ""))
+            scanned = int(scanned.replace(",", ""))
+            self.assertEqual(missing, 0, msg=f"The missing entries for Hash table {name} should be 0 but got {missing} instead.")
+            self.assertEqual(scanned, 80000, msg=f"A scan of Hash table {name} should see 80000 entries but saw {scanned} instead.")
+
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '4', '-s', '20000', '--tables', 'v2',
+                                               '--scan', '3', '--snapshot', '--remove')).decode()
+        results = re.findall(r'  - ([\d\,]+) entries \([\d\,]+ key bytes\) scanned by 3 threads in [\d\,]+ usec from a snapshot\n', hash_result)
+
+        self.assertEqual(len(results), 1, msg=f"Expected one snapshot scan of Hash table v2 but got {results}.")
+        scanned = int(results[0].replace(",", ""))
+        self.assertEqual(scanned, 80000, msg=f"A snapshot of Hash table v2 taken before removal should see 80000 entries but saw {scanned} instead.")
+
+    def test_13(self):
+        print("Running tester code 13...")
+        self.assertTrue(self.make, msg='make failed')
+
+        with tempfile.TemporaryDirectory() as directory:
+            image = os.path.join(directory, 'table.img')
+            hash_result = subprocess.check_output(('./hash-table-tester', '-t', '4', '-s', '20000', '--tables', 'all',
+                                                   '--image', image)).decode()
+            self.assertTrue(os.path.exists(image), msg="The tester should leave the last image behind.")
+            self.assertFalse(os.path.exists(image + '.tmp'), msg="Saving an image should not leave its temporary file behind.")
+        results = re.findall(r'Hash table (\w+): [\d\,]+ usec\n  - ([\d\,]+) missing\n(?:  - .*\n)*?  - [\d\,]+ byte image saved in [\d\,]+ usec, opened in [\d\,]+ usec, ([\d\,]+) missing\n', hash_result)
+
+        names = {name for name, _, _ in results}
+        self.assertTrue({'base', 'v1', 'v2', 'v3', 'oa', 'sharded'} <= names, msg=f"Expected an image of every hash table but got {names}.")
+        for name, missing, missing_image in results:
+            missing = int(missing.replace(",", ""))
+            missing_image = int(missing_image.replace(",", ""))
+            self.assertEqual(missing, 0, msg=f"The missing entries for Hash table {name} should be 0 but got {missing} instead.")
+            self.assertEqual(missing_image, 0, msg=f"The image of Hash table {name} should have every key but is missing {missing_image}.")
+
+    def test_14(self):
+        print("Running tester code 14...")
+        self.assertTrue(self.make, msg='make failed')
+
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '4', '-s', '20000', '--tables', 'all',
+                                               '--key-length', '4:40', '--own-keys', '--remove')).decode()
+        results = re.findall(r'Hash table (\w+): [\d\,]+ usec\n  - ([\d\,]+) missing\n(?:  - .*\n)*?  - ([\d\,]+) removed in [\d\,]+ usec, [\d\,]+ left behind, ([\d\,]+) missing\n', hash_result)
+        names = {name for name, _, _, _ in results}
+        self.assertTrue({'base', 'v1', 'v2', 'v3', 'oa', 'sharded'} <= names, msg=f"Expected a run of every hash table with long keys but got {names}.")
+        for name, missing, removed, missing_after in results:
+            self.assertEqual(int(missing.replace(",", "")), 0, msg=f"The missing entries for Hash table {name} with long keys should be 0 but got {missing} instead.")
+            self.assertEqual(int(removed.replace(",", "")), 40000, msg=f"Hash table {name} with long keys should remove 40000 entries but removed {removed} instead.")
+            self.assertEqual(int(missing_after.replace(",", "")), 0, msg=f"Hash table {name} with long keys should have no missing entries after removal but got {missing_after}.")
+
+        with tempfile.TemporaryDirectory() as directory:
+            keys = os.path.join(directory, 'keys.txt')
+            with open(keys, 'w', newline='') as file:
+                lines = [f'user:{i}:session' for i in range(8000)]
+                file.write('\n'.join(lines[:4000]) + '\n\n' + '\r\n'.join(lines[4000:]))
+            hash_result = subprocess.check_output(('./hash-table-tester', '-t', '4', '-s', '2000', '--tables', 'v1,v2',
+                                                   '--keys', keys, '--remove')).decode()
+            self.assertNotEqual(subprocess.run(('./hash-table-tester', '-t', '4', '-s', '2001', '--tables', 'v1',
+                                                '--keys', keys), capture_output=True).returncode, 0,
+                                msg="The tester should fail when the file has too few keys.")
+        results = re.findall(r'Hash table (\w+): [\d\,]+ usec\n  - ([\d\,]+) missing\n(?:  - .*\n)*?  - ([\d\,]+) removed in [\d\,]+ usec, [\d\,]+ left behind, ([\d\,]+) missing\n', hash_result)
+        self.assertEqual([name for name, _, _, _ in results], ['v1', 'v2'], msg=f"Expected a run of v1 and v2 with keys from a file but got {results}.")
+        for name, missing, removed, missing_after in results:
+            self.assertEqual(int(missing.replace(",", "")), 0, msg=f"The missing entries for Hash table {name} with keys from a file should be 0 but got {missing} instead.")
+            self.assertEqual(int(removed.replace(",", "")), 4000, msg=f"Hash table {name} with keys from a file should remove 4000 entries but removed {removed} instead.")
+            self.assertEqual(int(missing_after.replace(",", "")), 0, msg=f"Hash table {name} with keys from a file should have no missing entries after removal but got {missing_after}.")
+
+    def test_15(self):
+        print("Running tester code 15...")
+        self.assertTrue(self.make, msg='make failed')
+
+        with tempfile.TemporaryDirectory() as directory:
+            csv = os.path.join(directory, 'results.csv')
+            json_path = os.path.join(directory, 'results.json')
+            hash_result = subprocess.check_output(('./hash-table-tester', '-t', '4', '-s', '10000', '--tables', 'v1,v2',
+                                                   '--warmup', '1', '--repeat', '3', '--pin',
+                                                   '--csv', csv, '--json', json_path)).decode()
+            with open(csv) as file:
+                rows = file.read().splitlines()
+            with open(json_path) as file:
+                runs = json.load(file)
+
+        results = re.findall(r'Hash table (\w+): ([\d\,]+) usec\n  - ([\d\,]+) missing\n(?:  - .*\n)*?  - 3 runs: min ([\d\,]+), median ([\d\,]+), mean [\d\,]+, max ([\d\,]+), stddev [\d\,]+ usec\n', hash_result)
+        self.assertEqual([name for name, _, _, _, _, _ in results], ['v1', 'v2'], msg=f"Expected the spread of 3 runs of v1 and v2 but got {results}.")
+        for name, usec, missing, low, median, high in results:
+            usec, low, median, high = (int(n.replace(",", "")) for n in (usec, low, median, high))
+            self.assertEqual(int(missing.replace(",", "")), 0, msg=f"The missing entries for Hash table {name} should be 0 but got {missing} instead.")
+            self.assertEqual(usec, median, msg=f"Hash table {name} should report its median run.")
+            self.assertTrue(low <= median <= high, msg=f"Hash table {name} has a median of {median} outside {low} to {high}.")
+
+        self.assertEqual(rows[0].split(',')[:2], ['table', 'hash'], msg=f"The CSV file should start with a header but starts with {rows[0]}.")
+        self.assertEqual([row.split(',')[0] for row in rows[1:]], ['v1', 'v2'], msg=f"Expected a CSV row for v1 and v2 but got {rows[1:]}.")
+        self.assertEqual([run['table'] for run in runs], ['v1', 'v2'], msg=f"Expected a JSON run for v1 and v2 but got {runs}.")
+        for run in runs:
+            samples = sorted(run['samples_nsec'])
+            self.assertEqual(len(samples), 3, msg=f"Expected 3 samples for {run['table']} but got {samples}.")
+            self.assertEqual(run['median_nsec'], samples[1], msg=f"The median of {run['table']} should be the middle of {samples}.")
+            self.assertEqual((run['min_nsec'], run['max_nsec']), (samples[0], samples[2]), msg=f"The min and max of {run['table']} should bound {samples}.")
+
+    def test_16(self):
+        print("Running tester code 16...")
+        self.assertTrue(self.make, msg='make failed')
+
+        for hash_name in ('wy', 'bernstein'):
+            hash_result = subprocess.check_output(('./hash-table-tester', '-t', '8', '-s', '25000', '--tables', 'swiss',
+                                                   '--hash', hash_name, '--own-keys', '--mix', '1:1:1', '--remove')).decode()
+            results = re.findall(r'Hash table swiss: [\d\,]+ usec\n  - ([\d\,]+) missing\n(?:  - .*\n)*?  - ([\d\,]+) removed in [\d\,]+ usec, ([\d\,]+) left behind, ([\d\,]+) missing\n', hash_result)
+            self.assertEqual(len(results), 1, msg=f"Expected a run of Hash table swiss with {hash_name} but got {hash_result}.")
+            missing, removed, left, missing_after = (int(n.replace(",", "")) for n in results[0])
+            self.assertEqual(missing, 0, msg=f"The missing entries for Hash table swiss with {hash_name} should be 0 but got {missing} instead.")
+            self.assertEqual(removed, 100000, msg=f"Hash table swiss with {hash_name} should remove 100000 entries but removed {removed} instead.")
+            self.assertEqual(left, 0, msg=f"Hash table swiss with {hash_name} should leave no removed entries behind but left {left}.")
+            self.assertEqual(missing_after, 0, msg=f"Hash table swiss with {hash_name} should have no missing entries after removal but got {missing_after}.")
+
+    def test_17(self):
+        print("Running tester code 17...")
+        self.assertTrue(self.make, msg='make failed')
+
+        # 400000 keys grow v2 from HASH_TABLE_CAPACITY (4096) buckets to 262144, so the
+        # adds, batches, readers and removals below all run across six incremental migrations
+        for extra in (('--readers', '2', '--remove'), ('--batch', '16')):
+            hash_result = subprocess.check_output(('./hash-table-tester', '-t', '4', '-s', '100000', '--tables', 'v2') + extra).decode()
+            results = re.findall(r'Hash table v2: [\d\,]+ usec\n  - ([\d\,]+) missing\n', hash_result)
+            self.assertEqual(len(results), 1, msg=f"Expected a run of Hash table v2 with {extra} but got {hash_result}.")
+            missing = int(results[0].replace(",", ""))
+            self.assertEqual(missing, 0, msg=f"The missing entries for Hash table v2 across resizes with {extra} should be 0 but got {missing} instead.")
+            for removed, left, missing_after in re.findall(r'  - ([\d\,]+) removed in [\d\,]+ usec, ([\d\,]+) left behind, ([\d\,]+) missing\n', hash_result):
+                self.assertEqual(int(removed.replace(",", "")), 200000, msg=f"Hash table v2 should remove 200000 entries but removed {removed} instead.")
+                self.assertEqual(int(left.replace(",", "")), 0, msg=f"Hash table v2 should leave no removed entries behind but left {left}.")
+                self.assertEqual(int(missing_after.replace(",", "")), 0, msg=f"Hash table v2 should have no missing entries after removal but got {missing_after}.")
+
+    def test_18(self):
+        print("Running tester code 18...")
+        self.assertTrue(self.make, msg='make failed')
+
+        outputs = {}
+        for hash_name in ('wy', 'bernstein'):
+            hash_result = subprocess.check_output(('./hash-table-tester', '-t', '4', '-s', '20000', '--tables', 'all',
+                                                   '--hash', hash_name, '--remove', '--batch', '16')).decode()
+            outputs[hash_name] = re.sub(r'[\d\,]+ usec', 'usec', hash_result)
+        self.assertEqual(len(re.findall(r'  - 0 missing\n', outputs['wy'])), 7, msg=f"Expected every hash table to miss nothing but got {outputs['wy']}.")
+        self.assertEqual(outputs['bernstein'], outputs['wy'], msg="Hashing with bernstein should give the same results as the default hash, apart from timings.")
+
+    def test_19(self):
+        print("Running tester code 19...")
+        self.assertTrue(self.make, msg='make failed')
+
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '4', '-s', '20000', '--tables', 'all',
+                                               '--lookup-stats')).decode()
+        results = re.findall(r'Hash table (\w+): [\d\,]+ usec\n  - ([\d\,]+) missing\n(?:  - .*\n)*?  - (\d+\.\d{2}) entries visited, (\d+\.\d{3}) keys compared per lookup\n', hash_result)
+        names = [name for name, _, _, _ in results]
+        self.assertEqual(names, ['base', 'v1', 'v2', 'v3', 'oa', 'swiss', 'sharded'], msg=f"Expected lookup stats for every hash table but got {hash_result}.")
+        for name, missing, visited, compared in results:
+            self.assertEqual(int(missing.replace(",", "")), 0, msg=f"The missing entries for Hash table {name} should be 0 but got {missing} instead.")
+            self.assertEqual(float(compared), 1.0, msg=f"Hash table {name} found every key, so it should compare exactly one key per lookup but compared {compared}.")
+            self.assertGreaterEqual(float(visited), float(compared), msg=f"Hash table {name} cannot compare more keys ({compared}) than it visits entries ({visited}).")
+
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '4', '-s', '20000', '--tables', 'v2')).decode()
+        self.assertNotIn('per lookup', hash_result, msg="Lookup stats should only be printed with --lookup-stats.")
+
+    def test_20(self):
+        print("Running tester code 20...")
+        self.assertTrue(self.make, msg='make failed')
+
+        for allocator in ('arena', 'malloc'):
+            hash_result = subprocess.check_output(('./hash-table-tester', '-t', '4', '-s', '20000', '--tables', 'all',
+                                                   '--allocator', allocator, '--own-keys', '--key-length', '4:40',
+                                                   '--remove')).decode()
+            results = re.findall(r'Hash table (\w+): [\d\,]+ usec\n  - ([\d\,]+) missing\n(?:  - .*\n)*?  - ([\d\,]+) removed in [\d\,]+ usec, [\d\,]+ left behind, ([\d\,]+) missing\n', hash_result)
+            names = {name for name, _, _, _ in results}
+            self.assertTrue({'base', 'v1', 'v2', 'v3', 'oa', 'swiss', 'sharded'} <= names, msg=f"Expected a run of every hash table with the {allocator} allocator but got {names}.")
+            for name, missing, removed, missing_after in results:
+                self.assertEqual(int(missing.replace(",", "")), 0, msg=f"The missing entries for Hash table {name} with the {allocator} allocator should be 0 but got {missing} instead.")
+                self.assertEqual(int(removed.replace(",", "")), 40000, msg=f"Hash table {name} with the {allocator} allocator should remove 40000 entries but removed {removed} instead.")
+                self.assertEqual(int(missing_after.replace(",", "")), 0, msg=f"Hash table {name} with the {allocator} allocator should have no missing entries after removal but got {missing_after}.")
+
+    def test_21(self):
+        print("Running tester code 21...")
+        self.assertTrue(self.make, msg='make failed')
+
+        for extra in ((), ('--own-keys', '--remove')):
+            hash_result = subprocess.check_output(('./hash-table-tester', '-t', '4', '-s', '50000', '--tables', 'v2',
+                                                   '--readers', '3') + extra).decode()
+            results = re.findall(r'Hash table v2: [\d\,]+ usec\n  - ([\d\,]+) missing\n', hash_result)
+            self.assertEqual(len(results), 1, msg=f"Expected a run of Hash table v2 with {extra} but got {hash_result}.")
+            missing = int(results[0].replace(",", ""))
+            self.assertEqual(missing, 0, msg=f"The missing entries for Hash table v2 filled next to readers with {extra} should be 0 but got {missing} instead.")
+            lookups = re.findall(r'  - ([\d\,]+) lookups by 3 readers \(([\d\,]+) found\)\n', hash_result)
+            self.assertEqual(len(lookups), 2 if extra else 1, msg=f"Expected a line per phase the readers ran in but got {lookups}.")
+            for total, found in lookups:
+                total, found = int(total.replace(",", "")), int(found.replace(",", ""))
+                self.assertTrue(0 < total and found <= total, msg=f"The readers found {found} keys in {total} lookups.")
+            for left, missing_after in re.findall(r'  - [\d\,]+ removed in [\d\,]+ usec, ([\d\,]+) left behind, ([\d\,]+) missing\n', hash_result):
+                self.assertEqual(int(left.replace(",", "")), 0, msg=f"Hash table v2 should leave no removed entries behind next to readers but left {left}.")
+                self.assertEqual(int(missing_after.replace(",", "")), 0, msg=f"Hash table v2 should have no missing entries after removal next to readers but got {missing_after}.")